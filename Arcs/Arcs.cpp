@@ -1,17 +1,38 @@
 #include "config.h"
 #include "Arcs.h"
 #include "Arcs/DistanceEst.h"
+#include "Arcs/Evidence.h"
+#include "Arcs/IndexRuns.h"
+#include "Arcs/SharedBarcodes.h"
+#include "Common/BAM.h"
 #include "Common/ContigProperties.h"
+#include "Common/CountMinSketch.h"
 #include "Common/Estimate.h"
+#include "Common/HashFunction.h"
+#include "Common/MappedFile.h"
 #include "Common/SAM.h"
 #include "Common/StringUtil.h"
+#include "DataLayer/FastaIndex.h"
 #include "Graph/ContigGraph.h"
 #include "Graph/DirectedGraph.h"
 #include "Graph/DotIO.h"
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <tuple>
 #include <utility>
+#if _OPENMP
+# include <omp.h>
+#endif
 
 #define PROGRAM "arcs"
 
@@ -28,14 +49,15 @@ static const char USAGE_MESSAGE[] =
 PROGRAM " " PACKAGE_VERSION "\n"
 "Usage: arcs [OPTION]... ALIGNMENTS...\n"
 "\n"
-"ALIGNMENTS may be a SAM or BAM file.\n"
+"ALIGNMENTS may be a SAM or BAM file. A BAM file must have the suffix .bam.\n"
+"A SAM file may be compressed, and with -t a regular uncompressed or bgzip\n"
+"SAM file is parsed by several threads, whatever its name.\n"
 "The output of the aligner may be piped directly into ARCS by setting\n"
 "ALIGNMENTS to /dev/stdin, in which case it must be in SAM format.\n"
 "\n"
-"Paired reads must occur consecutively (interleaved) in the SAM/BAM file.\n"
-"The output of the aligner may either not be sorted,\n"
-"or may be sorted by read name using samtools sort -n.\n"
-"The SAM/BAM file must not be sorted by coordinate position.\n"
+"Paired reads must occur consecutively (interleaved) in the SAM/BAM file,\n"
+"as in the output of the aligner or sorted by read name using samtools sort -n,\n"
+"unless the file is sorted by coordinate and --coordinate-sorted is given.\n"
 "\n"
 "The barcode may be found in either the BX:Z:BARCODE SAM tag,\n"
 "or in the read (query) name following an underscore, READNAME_BARCODE.\n"
@@ -48,6 +70,55 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "\n"
 "   -f, --file=FILE       FASTA file of contig sequences to scaffold [optional]\n"
 "   -a, --fofName=FILE    text file listing input SAM/BAM filenames\n"
+"   -t, --threads=N       use N threads to read several alignment files\n"
+"                         concurrently, to parse a SAM file or stream in\n"
+"                         parallel, and to uncompress BAM and bgzip input [1]\n"
+"       --max-memory=SIZE bound the memory used to count the barcodes of the\n"
+"                         alignments to about SIZE bytes, which may have a\n"
+"                         suffix K, M, G or T, by sorting the counts in\n"
+"                         temporary files in $TMPDIR [unlimited]\n"
+"       --coordinate-sorted  read alignments that are sorted by coordinate,\n"
+"                         rather than grouped by read name, by buffering each\n"
+"                         read until its mate is read. The reads of a proper\n"
+"                         pair are buffered for at most the insert size,\n"
+"                         which is bounded by twice the 99.9th percentile of\n"
+"                         the insert sizes of the pairs seen so far.\n"
+"                         A pair is dropped when a secondary or supplementary\n"
+"                         alignment of its read name lies between its reads,\n"
+"                         but not when it follows both of them, whereas a\n"
+"                         read name with more than two alignments is always\n"
+"                         dropped from alignments grouped by read name.\n"
+"       --two-pass        read the alignments twice, first to count the reads\n"
+"                         per barcode, and then to store the read pairs of\n"
+"                         only the barcodes within -m, which uses less memory.\n"
+"                         Streams are read once, dropping the read pairs of\n"
+"                         barcodes once they exceed the maximum of -m.\n"
+"                         The barcodes outside -m are then not counted in\n"
+"                         the columns U_barcodes and V_barcodes of --tsv.\n"
+"       --fast-exit       exit without freeing the memory of the barcodes\n"
+"       --barcode-sketch=N  count the reads of a barcode exactly only after a\n"
+"                         sketch has counted N reads of it, which saves the\n"
+"                         memory of the barcodes with few reads. N is at most\n"
+"                         the minimum of -m and at most 255. A collision in\n"
+"                         the sketch may miscount a barcode by fewer than N\n"
+"                         reads. The barcodes with fewer than N reads are not\n"
+"                         reported. [0]\n"
+"       --barcode-sketch-size=SIZE  use about SIZE bytes for the sketch. With\n"
+"                         W = SIZE/4 and R reads, the estimate of a barcode\n"
+"                         exceeds its count by more than 2.72*R/W with\n"
+"                         probability at most 2%. [64M]\n"
+"       --save-evidence=FILE  save the barcodes and read pairs of the\n"
+"                         alignments to FILE, which uses more memory\n"
+"       --load-evidence=FILE  load the evidence saved by --save-evidence\n"
+"                         instead of reading alignments, to run again with\n"
+"                         other options. The options -c, -d, -l, -m, -r, -z\n"
+"                         and -e, which must be a multiple of 100, may differ.\n"
+"       --sweep=X=V1,V2,...  run ARCS for each value V of the option X, one of\n"
+"                         c, d, l, m and r. The sets share one pass over the\n"
+"                         alignments, which keeps the barcodes of every range\n"
+"                         of m, or the evidence of --load-evidence.\n"
+"                         Repeat to sweep a grid of several options. The\n"
+"                         output file names have a suffix such as _c3_l5.\n"
 "   -s, --seq_id=N        min sequence identity for read alignments [98]\n"
 "   -c, --min_reads=N     min aligned read pairs per barcode mapping [5]\n"
 "   -l, --min_links=N     min shared barcodes between contigs [0]\n"
@@ -62,6 +133,10 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "   -e, --end_length=N    contig head/tail length for masking alignments [30000]\n"
 "   -r, --error_percent=N p-value for head/tail assignment and link orientation\n"
 "                         (lower is more stringent) [0.05]\n"
+"       --binomial        use the exact binomial test rather than the normal\n"
+"                         approximation for -r, up to --significance-table\n"
+"       --significance-table=N  tabulate the tests of -r up to N read pairs\n"
+"                         or links, and compute them above N [16384]\n"
 "   -v, --run_verbose     verbose logging\n"
 "\n"
 " Distance Estimation Options:\n"
@@ -74,7 +149,7 @@ PROGRAM " " PACKAGE_VERSION "\n"
 "       --dist_tsv=FILE     write min/max distance estimates to FILE\n"
 "       --samples_tsv=FILE  write intra-contig distance/barcode samples to FILE\n";
 
-static const char shortopts[] = "f:a:B:s:c:Dl:z:b:g:m:d:e:r:v";
+static const char shortopts[] = "f:a:t:B:s:c:Dl:z:b:g:m:d:e:r:v";
 
 enum {
     OPT_HELP = 1,
@@ -87,12 +162,33 @@ enum {
     OPT_DIST_TSV,
     OPT_NO_DIST_EST,
     OPT_DIST_MEDIAN,
-    OPT_DIST_UPPER
+    OPT_DIST_UPPER,
+    OPT_MAX_MEMORY,
+    OPT_SAVE_EVIDENCE,
+    OPT_LOAD_EVIDENCE,
+    OPT_SWEEP,
+    OPT_TWO_PASS,
+    OPT_BARCODE_SKETCH,
+    OPT_BARCODE_SKETCH_SIZE,
+    OPT_FAST_EXIT,
+    OPT_COORDINATE_SORTED,
+    OPT_BINOMIAL,
+    OPT_SIGNIFICANCE_TABLE
 };
 
 static const struct option longopts[] = {
     {"file", required_argument, NULL, 'f'},
     {"fofName", required_argument, NULL, 'a'},
+    {"threads", required_argument, NULL, 't'},
+    {"max-memory", required_argument, NULL, OPT_MAX_MEMORY},
+    {"save-evidence", required_argument, NULL, OPT_SAVE_EVIDENCE},
+    {"load-evidence", required_argument, NULL, OPT_LOAD_EVIDENCE},
+    {"sweep", required_argument, NULL, OPT_SWEEP},
+    {"two-pass", no_argument, NULL, OPT_TWO_PASS},
+    {"barcode-sketch", required_argument, NULL, OPT_BARCODE_SKETCH},
+    {"barcode-sketch-size", required_argument, NULL, OPT_BARCODE_SKETCH_SIZE},
+    {"fast-exit", no_argument, NULL, OPT_FAST_EXIT},
+    {"coordinate-sorted", no_argument, NULL, OPT_COORDINATE_SORTED},
     {"bin_size", required_argument, NULL, 'B'},
     {"bx", no_argument, NULL, OPT_BX }, // ignored
     {"samples_tsv", required_argument, NULL, OPT_SAMPLES_TSV},
@@ -115,6 +211,8 @@ static const struct option longopts[] = {
     {"max_degree", required_argument, NULL, 'd'},
     {"end_length", required_argument, NULL, 'e'},
     {"error_percent", required_argument, NULL, 'r'},
+    {"binomial", no_argument, NULL, OPT_BINOMIAL},
+    {"significance-table", required_argument, NULL, OPT_SIGNIFICANCE_TABLE},
     {"run_verbose", required_argument, NULL, 'v'},
     {"version", no_argument, NULL, OPT_VERSION},
     {"help", no_argument, NULL, OPT_HELP},
@@ -124,6 +222,31 @@ static const struct option longopts[] = {
 /** Command line parameters. */
 static ARCS::ArcsParams params;
 
+/* Packs the barcodes into the keys of IndexMap and IndexMultMap */
+static BarcodeCodec barcodeCodec;
+
+/* The sorted runs of the maps, with --max-memory */
+static ARCS::IndexRuns indexRuns;
+
+/* The sketch of the reads of the barcodes, with --barcode-sketch */
+static CountMinSketch barcodeSketch;
+
+/*
+ * The barcode multiplicity prefilter of --two-pass. The first pass over
+ * the alignments only counts the reads of each barcode. The second pass
+ * adds to the IndexMap only the read pairs of the barcodes within the
+ * multiplicity range. A stream cannot be read twice, so instead its
+ * barcodes are dropped from the IndexMap once their running count
+ * exceeds the maximum multiplicity.
+ */
+enum PrefilterPass { PASS_ALL, PASS_COUNT, PASS_FILTER, PASS_TOMBSTONE };
+static struct {
+    PrefilterPass pass;
+    int minMult, maxMult;
+    /* The multiplicities counted by the first pass */
+    const ARCS::IndexMultMap* counts;
+} prefilter = { PASS_ALL, 0, 0, NULL };
+
 // Declared in Graph/Options.h and used by DotIO
 namespace opt {
     /** The size of a k-mer. */
@@ -144,12 +267,12 @@ unsigned g_nextContigName;
  * One end of a scaffold.
  * The left (head) is true and the right (tail) is false.
  */
-typedef std::pair<std::string, bool> ScaffoldEnd;
+typedef std::pair<ARCS::ContigID, bool> ScaffoldEnd;
 
 /** Hash a ScaffoldEnd. */
 struct HashScaffoldEnd {
     size_t operator()(const ScaffoldEnd& key) const {
-        return std::hash<std::string>()(key.first) ^ key.second;
+        return 2 * size_t(key.first) + key.second;
     }
 };
 
@@ -161,263 +284,1421 @@ static inline bool checkFlag(int flag)
         || flag == 35; // PAIRED,PROPER_PAIR,MREVERSE
 }
 
-/*
- * Check if character is one of the accepted ones.
- */
-bool checkChar(char c) {
-    return (c == 'M' || c == '=' || c == 'X' || c == 'I');
-}
-
 /*
  * Calculate the sequence identity from the cigar string
  * sequence length, and tags.
  */
-double calcSequenceIdentity(const std::string& line, const std::string& cigar, const std::string& seq) {
-
-    int qalen = 0;
-    std::stringstream ss;
-    for (auto i = cigar.begin(); i != cigar.end(); ++i) {
-        if (!isdigit(*i)) {
-            if (checkChar(*i)) {
-                ss << "\t";
-                int value = 0;
-                ss >> value;
-                qalen += value;
-                ss.str("");
-            } else {
-                ss.str("");
-            }
-        } else {
-            ss << *i;
-        }
-    }
+template <typename Record>
+double calcSequenceIdentity(const Record& rec) {
 
-    int edit_dist = 0;
-    std::size_t found = line.find("NM:i:");
-    if (found!=std::string::npos) {
-        edit_dist = std::strtol(&line[found + 5], 0, 10);
-    }
+    int qalen = rec.alignedQueryLength();
+    int edit_dist = rec.editDistance();
 
     double si = 0;
     if (qalen != 0) {
         double mins = qalen - edit_dist;
-        double div = mins/seq.length();
+        double div = mins/rec.seqLength();
         si = div * 100;
     }
 
     return si;
 }
 
+/*
+ * Extract the barcode from the BX:Z tag or from the read name
+ * following an underscore, and return its packed ID, which is 0 if
+ * the record has no barcode.
+ */
+template <typename Record>
+static inline BarcodeID getBarcode(const Record& rec)
+{
+    StringSpan bx = rec.barcodeTag();
+    if (!bx.empty())
+        return barcodeCodec.encode(bx);
+    const StringSpan& readName = rec.qname();
+    const char* found = std::find(
+            std::reverse_iterator<const char*>(readName.end()),
+            std::reverse_iterator<const char*>(readName.begin()),
+            '_').base();
+    if (found == readName.begin())
+        return 0;
+    // Check that the barcode is composed of only ACGT.
+    for (const char* p = found; p != readName.end(); ++p)
+        if (strchr("ACGTacgt", *p) == NULL || *p == '\0')
+            return 0;
+    return barcodeCodec.encode(StringSpan(found, readName.end() - found));
+}
 
-/* Get all scaffold sizes from FASTA file */
+/* Return whether the file is uncompressed by a program when opened. */
+static bool isCompressed(const std::string& path)
+{
+    return endsWith(path, ".gz") || endsWith(path, ".bz2")
+        || endsWith(path, ".xz") || endsWith(path, ".Z")
+        || endsWith(path, ".zip") || endsWith(path, ".tar");
+}
+
+/*
+ * Get all scaffold sizes from the FASTA index FILE.fai, without reading
+ * the sequences. If the index is missing or older than the FASTA file,
+ * index the FASTA file and save its index.
+ */
 void getScaffSizes(std::string file, ARCS::ScaffSizeList& scaffSizes) {
 
-    int counter = 0;
-    FastaReader in(file.c_str(), FastaReader::FOLD_CASE);
-    for (FastaRecord rec; in >> rec;) {
-        counter++;
-        std::string  scafName = rec.id;
-        int size = rec.seq.length();
-        scaffSizes.push_back(std::make_pair(rec.id, size));
+    const std::string faiPath = file + ".fai";
+    struct stat fastaStat, faiStat;
+    const bool indexable = stat(file.c_str(), &fastaStat) == 0
+        && S_ISREG(fastaStat.st_mode) && !isCompressed(file);
+    FastaIndex fai;
+    if (indexable && stat(faiPath.c_str(), &faiStat) == 0
+            && faiStat.st_mtime >= fastaStat.st_mtime && faiStat.st_size > 0) {
+        if (params.verbose)
+            std::cout << "Reading the FASTA index: " << faiPath << '\n';
+        std::ifstream in(faiPath.c_str());
+        assert_good(in, faiPath);
+        in >> fai;
+    } else {
+        fai.index(file);
+        if (indexable && fai.size() > 0) {
+            // Write a temporary file and rename it, so that a concurrent
+            // run never reads a partial index.
+            std::string tmpPath = faiPath + ".XXXXXX";
+            int fd = mkstemp(&tmpPath[0]);
+            if (fd >= 0) {
+                mode_t mask = umask(0);
+                umask(mask);
+                fchmod(fd, 0666 & ~mask);
+                close(fd);
+                std::ofstream out(tmpPath.c_str());
+                out << fai;
+                out.close();
+                if (out && rename(tmpPath.c_str(), faiPath.c_str()) == 0) {
+                    if (params.verbose)
+                        std::cout << "Wrote the FASTA index: " << faiPath << '\n';
+                } else {
+                    unlink(tmpPath.c_str());
+                }
+            }
+        }
     }
 
+    scaffSizes.reserve(scaffSizes.size() + fai.size());
+    for (const auto& rec : fai)
+        scaffSizes.push_back(std::make_pair(rec.id, int(rec.size)));
+
     if (params.verbose)
-        std::cout << "Saw " << counter << " sequences.\n";
+        std::cout << "Saw " << fai.size() << " sequences.\n";
 }
 
 /*
- * Read BAM file, if sequence identity greater than threashold
- * update indexMap. IndexMap also stores information about
- * contig number index algins with and counts.
+ * The hashes of the sequences of the headers that have been added or
+ * checked, so that an identical header is not checked again.
+ */
+static struct {
+    std::mutex mutex;
+    std::vector<uint64_t> hashes;
+} checkedHeaders;
+
+/*
+ * The sequences of the @SQ lines of the SAM/BAM header of a file.
+ * The sequences of the first header are added to scaffSizeList and
+ * contigs together. The sequences of a later header are checked
+ * against contigs, unless the header is identical to a header that has
+ * already been added or checked, which is found by its hash.
  */
-void readBAM(const std::string bamName, ARCS::IndexMap& imap, std::unordered_map<std::string, int>& indexMultMap,
-        ARCS::ScaffSizeList& scaffSizeList, ARCS::ScaffSizeMap& sMap)
+class SequenceHeader
 {
-    /* Open BAM file */
-    std::ifstream bamName_stream;
-    bamName_stream.open(bamName.c_str());
-    assert_good(bamName_stream, bamName);
-    if (bamName_stream.peek() == EOF) {
-        std::cerr << "error: alignments file is empty: " << bamName << '\n';
-        exit(EXIT_FAILURE);
+  public:
+    /* Whether to add the sequences or to check them */
+    explicit SequenceHeader(bool add) : m_add(add), m_hash(0) { }
+
+    /* Parse a line of the SAM header, and keep its sequence if it is an @SQ line. */
+    void addLine(const char* p, const char* end)
+    {
+        if (end - p < 4 || memcmp(p, "@SQ\t", 4) != 0)
+            return;
+        StringSpan name;
+        size_t size = 0;
+        bool haveName = false, haveSize = false;
+        for (const char* field = p + 4; field < end;) {
+            const char* tab = static_cast<const char*>(memchr(field, '\t', end - field));
+            const char* fieldEnd = tab != NULL ? tab : end;
+            if (fieldEnd - field > 3 && memcmp(field, "SN:", 3) == 0) {
+                name = StringSpan(field + 3, fieldEnd - field - 3);
+                haveName = true;
+            } else if (fieldEnd - field > 3 && memcmp(field, "LN:", 3) == 0) {
+                haveSize = true;
+                for (const char* q = field + 3; q != fieldEnd; ++q) {
+                    if (*q < '0' || *q > '9') {
+                        haveSize = false;
+                        break;
+                    }
+                    size = 10 * size + (*q - '0');
+                }
+            }
+            field = fieldEnd + 1;
+        }
+        if (!haveName || !haveSize) {
+            std::cerr << "error: parsing SAM header: " << std::string(p, end) << '\n';
+            exit(EXIT_FAILURE);
+        }
+        addSequence(name, size);
     }
 
-    std::string prevRN = "", readyToAddIndex = "", prevRef = "", readyToAddRefName = "";
-    int prevSI = 0, prevFlag = 0, prevMapq = 0, prevPos = -1, readyToAddPos = -1;
-    int ct = 1;
+    void addLine(const std::string& line)
+    {
+        addLine(line.data(), line.data() + line.size());
+    }
 
-    std::string line;
-    size_t linecount = 0;
+    /* Keep a sequence of the header. */
+    void addSequence(const StringSpan& name, size_t size)
+    {
+        m_hash = hashmem(name.data, name.length, m_hash + size);
+        m_seqs.push_back(ARCS::ScaffSizeList::value_type(name.str(), size));
+    }
+
+    /*
+     * Add the sequences kept so far to scaffSizeList and contigs, or
+     * check them.
+     */
+    void finish(ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+    {
+        if (m_seqs.empty())
+            return;
+        // Mix in the number of sequences, so that the hash of an empty
+        // header differs from the initial hash.
+        const uint64_t hash = hashmem(&m_hash, sizeof m_hash, m_seqs.size());
+        {
+            std::lock_guard<std::mutex> lock(checkedHeaders.mutex);
+            if (std::find(checkedHeaders.hashes.begin(), checkedHeaders.hashes.end(),
+                        hash) != checkedHeaders.hashes.end()) {
+                m_seqs.clear();
+                return;
+            }
+        }
+
+        if (m_add) {
+            scaffSizeList.reserve(scaffSizeList.size() + m_seqs.size());
+            contigs.reserve(contigs.size() + m_seqs.size());
+            for (const auto& seq : m_seqs) {
+                scaffSizeList.push_back(seq);
+                contigs.add(seq.first, seq.second);
+            }
+        } else {
+            for (const auto& seq : m_seqs)
+                checkSequence(seq.first, seq.second, contigs);
+        }
+        m_seqs.clear();
+
+        std::lock_guard<std::mutex> lock(checkedHeaders.mutex);
+        checkedHeaders.hashes.push_back(hash);
+    }
+
+  private:
+    /* Check that a sequence of the header matches the sequence in contigs. */
+    static void checkSequence(const std::string& name, size_t size,
+            const ARCS::Contigs& contigs)
+    {
+        ARCS::ContigID id;
+        if (!contigs.find(name, id)) {
+            std::cerr << "error: unexpected sequence: " << name << " of size " << size;
+            exit(EXIT_FAILURE);
+        } else if (contigs.lengths()[id] != (int)size) {
+            std::cerr << "error: mismatched sequence lengths: sequence "
+                << name << ": " << contigs.lengths()[id] << " != " << size;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bool m_add;
+    uint64_t m_hash;
+    ARCS::ScaffSizeList m_seqs;
+};
+
+/* Warn about the first unpaired read. */
+static void warnUnpaired(const StringSpan& prevName, const StringSpan& currName)
+{
+    std::cerr << "Warning: Skipping an unpaired read. Read pairs should be consecutive in the SAM/BAM file.\n"
+        "  Prev read: " << prevName << "\n"
+        "  Curr read: " << currName << std::endl;
+}
+
+/* Report the number of unpaired reads. */
+static void warnUnpairedCount(size_t countUnpaired)
+{
+    if (countUnpaired > 0)
+        std::cerr << "Warning: Skipped " << countUnpaired << " unpaired reads. Read pairs should be consecutive in the SAM/BAM file.\n";
+}
+
+/*
+ * An upper bound of the insert size of the proper pairs, which is twice
+ * a high quantile of the distances between the reads of the pairs seen
+ * so far. The distances are counted in a histogram whose buckets split
+ * each power of two in eight.
+ */
+class InsertSizeBound
+{
+  public:
+    InsertSizeBound() : m_count(0), m_bound(INT_MAX) { m_hist.fill(0); }
+
+    /* Return the bound, which is INT_MAX until enough pairs are seen. */
+    int get() const { return m_bound; }
+
+    /* Add the distance of a pair. Return whether the bound has changed. */
+    bool add(int distance)
+    {
+        ++m_hist[bucket(distance)];
+        ++m_count;
+        if (m_count < MIN_PAIRS || (m_count != MIN_PAIRS && m_count % UPDATE_PAIRS != 0))
+            return false;
+        size_t n = 0;
+        size_t b = 0;
+        while (n + m_hist[b] < m_count - m_count / 1000)
+            n += m_hist[b++];
+        int bound = int(std::min<int64_t>(INT_MAX, 2 * int64_t(upperBound(b))));
+        if (bound == m_bound)
+            return false;
+        m_bound = bound;
+        return true;
+    }
+
+  private:
+    static const size_t MIN_PAIRS = 10000;
+    static const size_t UPDATE_PAIRS = 1 << 16;
+
+    /* Return the bucket of a distance. */
+    static size_t bucket(int distance)
+    {
+        unsigned d = std::max(distance, 0);
+        if (d < 16)
+            return d;
+        unsigned k = 31 - __builtin_clz(d);
+        return 16 + 8 * (k - 4) + ((d >> (k - 3)) & 7);
+    }
+
+    /* Return the largest distance of a bucket. */
+    static int64_t upperBound(size_t b)
+    {
+        if (b < 16)
+            return b;
+        unsigned k = 4 + (b - 16) / 8;
+        return (int64_t(8 + (b - 16) % 8 + 1) << (k - 3)) - 1;
+    }
+
+    std::array<size_t, 16 + 8 * 28> m_hist;
+    size_t m_count;
+    int m_bound;
+};
+
+/*
+ * Pair consecutive alignment records of the same read, and update
+ * the IndexMap with the read pairs whose sequence identity is greater
+ * than the threshold. Record is either SAMRecord or BAMRecord.
+ */
+template <typename Record>
+class AlignmentPairer
+{
+  public:
+    /*
+     * Several pairers may share contigs. The sequences that are
+     * missing from contigs are added as unknown contigs.
+     * When quiet is true, do not print warnings nor progress, so that
+     * the pairers of several chunks of a file may report them together.
+     */
+    AlignmentPairer(ARCS::IndexMap& imap,
+            ARCS::IndexMultMap& indexMultMap,
+            ARCS::Contigs& contigs, bool quiet = false)
+        : imap(imap), indexMultMap(indexMultMap), contigs(contigs), quiet(quiet),
+        numEnds(indexRuns.enabled() ? ARCS::IndexRuns::countEnds(imap) : 0),
+        cur(0), index(0), readyToAddIndex(0), readyToAddPos(-1),
+        ct(1), linecount(0), countUnpaired(0), matePos(0), peakMates(0) { }
+
+    /*
+     * Return the buffer into which to read the next record.
+     * Two buffers alternate, so that the first read of a pair remains
+     * valid while reading its mate, and are reused so that reading a
+     * record does not allocate memory.
+     */
+    std::string& buffer() { return buffers[cur]; }
+
+    /* Add the next alignment record, which was read into buffer(). */
+    void add(const Record& rec);
+
+    /*
+     * End a chunk of the file, which is followed by a record named
+     * nextName that belongs to the next chunk. Account for that record
+     * as add would, without adding it.
+     */
+    void endChunk(const StringSpan& nextName);
+
+    /* Report the number of unpaired reads. */
+    void finish()
+    {
+        if (!params.coordinate_sorted) {
+            warnUnpairedCount(countUnpaired);
+            return;
+        }
+        evictMates(INT_MAX);
+        if (countUnpaired > 0)
+            std::cerr << "Warning: Skipped " << countUnpaired
+                << " reads whose mates were not found.\n";
+        if (params.verbose)
+            std::cout << "Buffered at most " << peakMates
+                << " reads waiting for their mates" << std::endl;
+    }
+
+    /* Return the number of unpaired reads. */
+    size_t unpaired() const { return countUnpaired; }
+
+    /* Return the names of the first unpaired read and its successor. */
+    const std::pair<std::string, std::string>& firstUnpaired() const
+    {
+        return firstUnpairedNames;
+    }
+
+  private:
+    /* Add the previous read pair to the IndexMap. */
+    void addReadPair();
+
+    /* Return whether to add the read pairs of the barcode, with --two-pass. */
+    bool keepBarcode(BarcodeID barcode);
+
+    /* Count a read of the barcode. */
+    void countRead(BarcodeID barcode);
+
+    /* Add a record of coordinate-sorted alignments. */
+    void addSorted(const Record& rec);
+
+    /*
+     * Evict the buffered reads whose mates would precede pos, which
+     * are then unpaired.
+     */
+    void evictMates(int pos);
+
+    /* Evict the buffered reads at the bound of the insert size. */
+    void boundMates();
+
+    /* Spill the maps to a sorted run when they reach --max-memory. */
+    void spillIfFull()
+    {
+        if (indexRuns.full(imap, numEnds, indexMultMap)) {
+            indexRuns.spill(imap, indexMultMap);
+            numEnds = 0;
+        }
+    }
+
+    /* Count an unpaired read, which is followed by a read named currName. */
+    void addUnpaired(const StringSpan& currName);
+
+    ARCS::IndexMap& imap;
+    ARCS::IndexMultMap& indexMultMap;
+    ARCS::Contigs& contigs;
+    bool quiet;
+
+    /* The number of scaffold ends of imap, with --max-memory */
+    size_t numEnds;
+
+    std::string buffers[2];
+    unsigned cur;
+
+    /* The first read of the current pair */
+    Record prev;
+    BarcodeID index, readyToAddIndex;
+    std::string readyToAddRefName;
+    int readyToAddPos;
+    int ct;
+    size_t linecount;
 
     // Number of unpaired reads.
-    size_t countUnpaired = 0;
+    size_t countUnpaired;
+    std::pair<std::string, std::string> firstUnpairedNames;
+
+    /*
+     * With --coordinate-sorted, the reads that pass the filters and
+     * whose mates follow them, keyed by read name, and whether the
+     * pair still passes. A read is evicted when its mate has not been
+     * found at the position of the mate, or further than the bound of
+     * the insert size, so that the reads buffered span at most the
+     * insert size of the proper pairs.
+     */
+    struct Mate {
+        int pos;
+        bool pass;
+    };
+    std::unordered_map<std::string, Mate> mates;
+    typedef std::pair<int, std::string> MatePosition;
+    std::priority_queue<MatePosition, std::vector<MatePosition>,
+        std::greater<MatePosition>> matePositions;
+    std::string mateRefName, mateName;
+    int matePos;
+    size_t peakMates;
+    InsertSizeBound insertSize;
+};
+
+template <typename Record>
+bool AlignmentPairer<Record>::keepBarcode(BarcodeID barcode)
+{
+    switch (prefilter.pass) {
+      case PASS_FILTER: {
+        auto it = prefilter.counts->find(barcode);
+        return it != prefilter.counts->end()
+            && it->second >= prefilter.minMult && it->second <= prefilter.maxMult;
+      }
+      case PASS_TOMBSTONE: {
+        auto it = indexMultMap.find(barcode);
+        if (it == indexMultMap.end() || it->second <= prefilter.maxMult)
+            return true;
+        auto scafMap = imap.find(barcode);
+        if (scafMap != imap.end()) {
+            numEnds -= scafMap->second.size();
+            imap.erase(scafMap);
+        }
+        return false;
+      }
+      default:
+        return true;
+    }
+}
+
+/*
+ * With --barcode-sketch, count the reads of a barcode in the sketch,
+ * and give the barcode an exact count once the sketch reaches its
+ * limit. The pairer whose read reaches the limit adds the reads
+ * counted by the sketch, and the other pairers add one per read.
+ */
+template <typename Record>
+void AlignmentPairer<Record>::countRead(BarcodeID barcode)
+{
+    if (!barcodeSketch.enabled()) {
+        indexMultMap[barcode]++;
+        return;
+    }
+    auto it = indexMultMap.find(barcode);
+    if (it != indexMultMap.end()) {
+        it->second++;
+        return;
+    }
+    unsigned estimate = barcodeSketch.increment(barcode);
+    if (estimate + 1 == barcodeSketch.limit())
+        indexMultMap[barcode] = estimate + 1;
+    else if (estimate == barcodeSketch.limit())
+        indexMultMap[barcode] = 1;
+}
+
+template <typename Record>
+void AlignmentPairer<Record>::addReadPair()
+{
+    if (!keepBarcode(readyToAddIndex))
+        return;
+
+    int size;
+    ARCS::ContigID id = contigs.findOrAddUnknown(readyToAddRefName, size);
+
+    /* Keep the position for any -e and -z when saving the evidence */
+    if (!params.save_evidence.empty()) {
+        ARCS::ScafMap& scafMap = imap[readyToAddIndex];
+        if (scafMap[ARCS::ScafMap::key_type(id, ARCS::Evidence::end(readyToAddPos, size))]++ == 0)
+            ++numEnds;
+        return;
+    }
+
+    if (size >= params.min_size) {
+
+       /*
+        * If length of sequence is less than 2 x end_length, split
+        * the sequence in half to determing head/tail
+        */
+       int cutOff = params.end_length;
+       if (cutOff == 0 || size <= cutOff * 2)
+           cutOff = size/2;
+
+       /*
+        * pair <X, true> indicates read pair aligns to head,
+        * pair <X, false> indicates read pair aligns to tail
+        */
+       ScaffoldEnd key(id, true);
+       ScaffoldEnd keyR(id, false);
+
+       /* Aligns to head */
+       if (readyToAddPos <= cutOff) {
+           ARCS::ScafMap& scafMap = imap[readyToAddIndex];
+           const size_t n = scafMap.size();
+           scafMap[key]++;
+           scafMap.insert(ARCS::ScafMap::value_type(keyR, 0));
+           numEnds += scafMap.size() - n;
+
+        /* Aligns to tail */
+       } else if (readyToAddPos > size - cutOff) {
+           ARCS::ScafMap& scafMap = imap[readyToAddIndex];
+           const size_t n = scafMap.size();
+           scafMap[keyR]++;
+           scafMap.insert(ARCS::ScafMap::value_type(key, 0));
+           numEnds += scafMap.size() - n;
+       }
+
+    }
+}
+
+template <typename Record>
+void AlignmentPairer<Record>::addUnpaired(const StringSpan& currName)
+{
+    if (countUnpaired == 0) {
+        if (quiet)
+            firstUnpairedNames = std::make_pair(prev.qname().str(), currName.str());
+        else
+            warnUnpaired(prev.qname(), currName);
+    }
+    ++countUnpaired;
+    if (!quiet && countUnpaired % 1000000 == 0)
+        std::cerr << "Warning: Skipped " << countUnpaired << " unpaired reads." << std::endl;
+}
+
+template <typename Record>
+void AlignmentPairer<Record>::add(const Record& rec)
+{
+    linecount++;
+    const StringSpan& readName = rec.qname();
+
+    /* Parse the index from the BX tag or the readName */
+    index = getBarcode(rec);
+
+    /* Keep track of index multiplicity, which the first pass of --two-pass has counted */
+    if (index != 0 && prefilter.pass != PASS_FILTER)
+        countRead(index);
+    if (prefilter.pass == PASS_COUNT)
+        return;
+
+    if (params.coordinate_sorted) {
+        addSorted(rec);
+        spillIfFull();
+        return;
+    }
+
+    if (ct == 2 && readName != prev.qname()) {
+        addUnpaired(readName);
+        ct = 1;
+    }
+
+    if (ct >= 3)
+        ct = 1;
+    if (ct == 1) {
+        if (readName != prev.qname()) {
+            /* Keep this record as the first read of the pair. */
+            prev = rec;
+            cur ^= 1;
+
+            /*
+             * Read names are different so we can add the previous index and scafName as
+             * long as there were only two mappings (one for each read)
+             */
+            if (readyToAddIndex != 0 && !readyToAddRefName.empty() && readyToAddRefName.compare("*") != 0 && readyToAddPos != -1) {
+                addReadPair();
+                readyToAddIndex = 0;
+                readyToAddRefName.clear();
+                readyToAddPos = -1;
+            }
+        } else {
+            ct = 0;
+            readyToAddIndex = 0;
+            readyToAddRefName.clear();
+            readyToAddPos = -1;
+        }
+    } else if (ct == 2) {
+        assert(readName == prev.qname());
+        /*
+         * Check the cheap filters first, and calculate the
+         * sequence identity only for read pairs that pass them.
+         */
+        if (rec.seqLength() != 0 && checkFlag(rec.flag()) && checkFlag(prev.flag())
+                && rec.mapq() != 0 && prev.mapq() != 0) {
+            const StringSpan& scafName = rec.rname();
+            if (prev.rname() == scafName && scafName != "*" && !scafName.empty() && index != 0
+                    && (int)calcSequenceIdentity(rec) >= params.seq_id
+                    && (int)calcSequenceIdentity(prev) >= params.seq_id) {
+
+                readyToAddIndex = index;
+                readyToAddRefName.assign(scafName.data, scafName.length);
+                /* Take average read alignment position between read pairs */
+                readyToAddPos = (prev.pos() + rec.pos())/2;
+            }
+        }
+    }
+    ct++;
+
+    spillIfFull();
+
+    if (!quiet && params.verbose && linecount % 10000000 == 0)
+        std::cout << "On line " << linecount << std::endl;
+}
+
+/*
+ * Pair the reads of coordinate-sorted alignments. A read is buffered
+ * until its mate, which follows it, is read. The read pairs are
+ * filtered as the read pairs of alignments grouped by read name.
+ */
+template <typename Record>
+void AlignmentPairer<Record>::addSorted(const Record& rec)
+{
+    const StringSpan& refName = rec.rname();
+    const int pos = rec.pos();
+    if (refName != StringSpan(mateRefName)) {
+        evictMates(INT_MAX);
+        mateRefName.assign(refName.data, refName.length);
+    } else if (pos < matePos) {
+        std::cerr << "error: the alignments are not sorted by coordinate: "
+            << rec.qname() << " at " << refName << ':' << pos << '\n';
+        exit(EXIT_FAILURE);
+    }
+    matePos = pos;
+    evictMates(pos);
+
+    // Skip the reads whose mate aligns to another sequence.
+    const int flag = rec.flag();
+    if (refName == "*" || (rec.rnext() != "=" && rec.rnext() != refName))
+        return;
+
+    mateName.assign(rec.qname().data, rec.qname().length);
+    auto it = mates.find(mateName);
+
+    // Drop a pair with a secondary or supplementary alignment read
+    // between its reads, as a read name with more than two alignments
+    // is dropped when the alignments are grouped by read name. Such an
+    // alignment that follows both reads is not seen, since the pair
+    // has already been added.
+    if ((flag & 0x900) != 0) {
+        if (it != mates.end())
+            it->second.pass = false;
+        return;
+    }
 
-    // Whether to add SAM SQ headers to sMap.
-    const bool addSAMSequenceLengths = sMap.empty();
+    const bool pass = rec.seqLength() != 0 && checkFlag(flag) && rec.mapq() != 0
+        && (int)calcSequenceIdentity(rec) >= params.seq_id;
+    if (it == mates.end()) {
+        // Buffer only a read whose pair may pass, and whose mate is
+        // within the bound of the insert size. A read whose mate is at
+        // the same position is buffered regardless, so that its mate
+        // does not take it for the first read of the pair.
+        const int distance = rec.pnext() - pos;
+        if (distance < 0 || distance > insertSize.get() || (!pass && distance > 0))
+            return;
+    }
+
+    if (it != mates.end()) {
+        if (pass && it->second.pass && index != 0) {
+            if (insertSize.add(pos - it->second.pos))
+                boundMates();
+            readyToAddIndex = index;
+            readyToAddRefName = mateRefName;
+            /* Take average read alignment position between read pairs */
+            readyToAddPos = (it->second.pos + pos)/2;
+            addReadPair();
+            readyToAddIndex = 0;
+            readyToAddRefName.clear();
+            readyToAddPos = -1;
+        }
+        mates.erase(it);
+    } else {
+        Mate mate = { pos, pass };
+        mates.insert(std::make_pair(mateName, mate));
+        matePositions.push(MatePosition(rec.pnext(), mateName));
+        peakMates = std::max(peakMates, mates.size());
+    }
+}
+
+template <typename Record>
+void AlignmentPairer<Record>::evictMates(int pos)
+{
+    while (!matePositions.empty() && matePositions.top().first < pos) {
+        countUnpaired += mates.erase(matePositions.top().second);
+        matePositions.pop();
+    }
+}
 
-    /* Read each line of the BAM file */
-    while (getline(bamName_stream, line)) {
+/*
+ * Evict the buffered reads at the bound of the insert size, which has
+ * changed, rather than at the positions of their mates.
+ */
+template <typename Record>
+void AlignmentPairer<Record>::boundMates()
+{
+    std::vector<MatePosition> positions;
+    positions.reserve(matePositions.size());
+    for (; !matePositions.empty(); matePositions.pop()) {
+        const MatePosition& x = matePositions.top();
+        auto it = mates.find(x.second);
+        if (it == mates.end())
+            continue;
+        int64_t bound = int64_t(it->second.pos) + insertSize.get();
+        positions.push_back(MatePosition(int(std::min<int64_t>(x.first, bound)), x.second));
+    }
+    matePositions = decltype(matePositions)(std::greater<MatePosition>(), std::move(positions));
+}
+
+template <typename Record>
+void AlignmentPairer<Record>::endChunk(const StringSpan& nextName)
+{
+    /*
+     * The next chunk begins with a read whose name differs from the
+     * name of the last read of this chunk, so that the next record
+     * would complete the pending read pair.
+     */
+    assert(nextName != prev.qname());
+    if (ct == 2)
+        addUnpaired(nextName);
+    if (readyToAddIndex != 0 && !readyToAddRefName.empty() && readyToAddRefName.compare("*") != 0 && readyToAddPos != -1) {
+        addReadPair();
+        readyToAddIndex = 0;
+        readyToAddRefName.clear();
+        readyToAddPos = -1;
+    }
+}
+
+/*
+ * Read a BAM file natively, without converting it to SAM.
+ * Uncompress it using the specified number of threads.
+ */
+static void readBAMBinary(const std::string& bamName, unsigned threads,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    BAMReader in(bamName, threads);
+
+    // Whether to add the BAM header sequences to contigs.
+    SequenceHeader header(contigs.empty());
+    for (const auto& ref : in.references())
+        header.addSequence(ref.first, ref.second);
+    header.finish(scaffSizeList, contigs);
+
+    AlignmentPairer<BAMRecord> pairer(imap, indexMultMap, contigs);
+    for (BAMRecord rec; in.read(pairer.buffer(), rec);)
+        pairer.add(rec);
+    pairer.finish();
+}
+
+/* Read the lines of an input stream. */
+struct StreamLineReader
+{
+    std::istream& in;
+    StreamLineReader(std::istream& in) : in(in) { }
+    bool getline(std::string& line) { return (bool)std::getline(in, line); }
+};
+
+/*
+ * Read a SAM file from a LineReader, which is either a
+ * StreamLineReader, a StringLineReader or a BGZFReader.
+ */
+template <typename LineReader>
+static void readSAM(LineReader& in, AlignmentPairer<SAMRecord>& pairer,
+        SequenceHeader& header,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    SAMRecord rec;
+
+    /* Read each line of the SAM file */
+    while (in.getline(pairer.buffer())) {
+        const std::string& line = pairer.buffer();
         if (line.empty())
             continue;
         if (line[0] == '@') {
-            // Parse the SAM header.
-            if (startsWith(line, "@SQ\t")) {
-                std::stringstream ss(line);
-                std::string name;
-                size_t size = 0;
-                ss >> expect("@SQ\tSN:") >> name >> expect("\tLN:") >> size;
-                if (!ss) {
-                    std::cerr << "error: parsing SAM header: " << line << '\n';
-                    exit(EXIT_FAILURE);
-                }
-                if (addSAMSequenceLengths) {
-                    ARCS::ScaffSizeMap::value_type sq_ln(name, size);
-                    scaffSizeList.push_back(sq_ln);
-                    sMap.insert(sq_ln);
-                } else {
-                    auto it = sMap.find(name);
-                    if (it == sMap.end()) {
-                        std::cerr << "error: unexpected sequence: " << name << " of size " << size;
-                        exit(EXIT_FAILURE);
-                    } else if (it->second != (int)size) {
-                        std::cerr << "error: mismatched sequence lengths: sequence "
-                            << name << ": " << it->second << " != " << size;
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            }
+            header.addLine(line);
         } else {
-            linecount++;
-
-            std::stringstream ss(line);
-            std::string readName, scafName, cigar, rnext, seq, qual, tags;
-            int flag, pos, mapq, pnext, tlen;
-
-            ss >> readName >> flag >> scafName >> pos >> mapq >> cigar
-                >> rnext >> pnext >> tlen >> seq >> qual >> std::ws;
-
-            getline(ss, tags);
-
-            /* Parse the index from the readName */
-            std::string index = parseBXTag(tags);
-            if (index.empty()) {
-                std::size_t found = readName.rfind("_");
-                if (found != std::string::npos) {
-                    index = readName.substr(found + 1);
-                    // Check that the barcode is composed of only ACGT.
-                    if (index.find_first_not_of("ACGTacgt") != std::string::npos)
-                      index.clear();
-                }
-            }
+            header.finish(scaffSizeList, contigs);
+            rec.parse(line);
+            pairer.add(rec);
+        }
+    }
+    header.finish(scaffSizeList, contigs);
+}
 
-            /* Keep track of index multiplicity */
-            if (!index.empty())
-                indexMultMap[index]++;
-
-            /* Calculate the sequence identity */
-            int si = calcSequenceIdentity(line, cigar, seq);
-
-            if (ct == 2 && readName != prevRN) {
-                if (countUnpaired == 0)
-                    std::cerr << "Warning: Skipping an unpaired read. Read pairs should be consecutive in the SAM/BAM file.\n"
-                        "  Prev read: " << prevRN << "\n"
-                        "  Curr read: " << readName << std::endl;
-                ++countUnpaired;
-                if (countUnpaired % 1000000 == 0)
-                    std::cerr << "Warning: Skipped " << countUnpaired << " unpaired reads." << std::endl;
-                ct = 1;
-            }
+/*
+ * Read the SAM records of a range of memory, such as a memory-mapped
+ * file, which are parsed in place without copying them.
+ */
+static void readSAM(const char* p, const char* end,
+        AlignmentPairer<SAMRecord>& pairer, SequenceHeader& header,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    SAMRecord rec;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* lineEnd = nl != NULL ? nl : end;
+        if (lineEnd == p) {
+            // Skip an empty line.
+        } else if (*p == '@') {
+            header.addLine(p, lineEnd);
+        } else {
+            header.finish(scaffSizeList, contigs);
+            rec.parse(p, lineEnd);
+            pairer.add(rec);
+        }
+        p = lineEnd + 1;
+    }
+    header.finish(scaffSizeList, contigs);
+}
 
-            if (ct >= 3)
-                ct = 1;
-            if (ct == 1) {
-                if (readName.compare(prevRN) != 0) {
-                    prevRN = readName;
-                    prevSI = si;
-                    prevFlag = flag;
-                    prevMapq = mapq;
-                    prevRef = scafName;
-                    prevPos = pos;
-
-
-                    /*
-                     * Read names are different so we can add the previous index and scafName as
-                     * long as there were only two mappings (one for each read)
-                     */
-                    if (!readyToAddIndex.empty() && !readyToAddRefName.empty() && readyToAddRefName.compare("*") != 0 && readyToAddPos != -1) {
-
-                        int size = sMap[readyToAddRefName];
-                        if (size >= params.min_size) {
-
-                           /*
-                            * If length of sequence is less than 2 x end_length, split
-                            * the sequence in half to determing head/tail
-                            */
-                           int cutOff = params.end_length;
-                           if (cutOff == 0 || size <= cutOff * 2)
-                               cutOff = size/2;
-
-                           /*
-                            * pair <X, true> indicates read pair aligns to head,
-                            * pair <X, false> indicates read pair aligns to tail
-                            */
-                           ScaffoldEnd key(readyToAddRefName, true);
-                           ScaffoldEnd keyR(readyToAddRefName, false);
-
-                           /* Aligns to head */
-                           if (readyToAddPos <= cutOff) {
-                               imap[readyToAddIndex][key]++;
-
-                               if (imap[readyToAddIndex].count(keyR) == 0)
-                                   imap[readyToAddIndex][keyR] = 0;
-
-                            /* Aligns to tail */
-                           } else if (readyToAddPos > size - cutOff) {
-                               imap[readyToAddIndex][keyR]++;
-
-                               if (imap[readyToAddIndex].count(key) == 0)
-                                   imap[readyToAddIndex][key] = 0;
-                           }
-
-                        }
-                        readyToAddIndex = "";
-                        readyToAddRefName = "";
-                        readyToAddPos = -1;
-                    }
-                } else {
-                    ct = 0;
-                    readyToAddIndex = "";
-                    readyToAddRefName = "";
-                    readyToAddPos = -1;
-                }
-            } else if (ct == 2) {
-                assert(readName == prevRN);
-                if (!seq.empty() && checkFlag(flag) && checkFlag(prevFlag)
-                        && mapq != 0 && prevMapq != 0 && si >= params.seq_id && prevSI >= params.seq_id) {
-                    if (prevRef.compare(scafName) == 0 && scafName.compare("*") != 0 && !scafName.empty() && !index.empty()) {
-
-                        readyToAddIndex = index;
-                        readyToAddRefName = scafName;
-                        /* Take average read alignment position between read pairs */
-                        readyToAddPos = (prevPos + pos)/2;
-                    }
-                }
+/*
+ * Read a SAM file from a LineReader, and report the unpaired reads.
+ */
+template <typename LineReader>
+static void readSAM(LineReader& in, ARCS::IndexMap& imap,
+        ARCS::IndexMultMap& indexMultMap,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    // Whether to add SAM SQ headers to contigs.
+    SequenceHeader header(contigs.empty());
+
+    AlignmentPairer<SAMRecord> pairer(imap, indexMultMap, contigs);
+    readSAM(in, pairer, header, scaffSizeList, contigs);
+    pairer.finish();
+}
+
+/* Return the read name of a SAM record. */
+static inline StringSpan getReadName(const std::string& line)
+{
+    size_t n = line.find('\t');
+    return StringSpan(line.data(), n == std::string::npos ? line.size() : n);
+}
+
+/*
+ * Return the offset of the first record at or after pos whose read
+ * name differs from that of the preceding record, and store its read
+ * name in nextName. Return size if there is no such record.
+ * The pairs of reads are never split at such a boundary.
+ */
+static size_t findReadBoundary(const char* data, size_t size, size_t pos,
+        std::string& nextName)
+{
+    assert(pos > 0);
+    // Move to the beginning of the line following pos - 1.
+    const char* p = static_cast<const char*>(
+            memchr(data + pos - 1, '\n', size - (pos - 1)));
+    if (p == NULL)
+        return size;
+    ++p;
+
+    const char* end = data + size;
+    StringSpan prevName;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* lineEnd = nl != NULL ? nl : end;
+        if (lineEnd != p && *p != '@') {
+            const char* tab = static_cast<const char*>(memchr(p, '\t', lineEnd - p));
+            StringSpan readName(p, (tab != NULL ? tab : lineEnd) - p);
+            if (!prevName.empty() && readName != prevName) {
+                nextName = readName.str();
+                return p - data;
             }
-           ct++;
+            prevName = readName;
+        }
+        p = lineEnd + 1;
+    }
+    return size;
+}
+
+/*
+ * Add the counts of the IndexMap src to dst, and clear src.
+ * Return the number of scaffold ends added to dst.
+ */
+static size_t mergeIndexMap(ARCS::IndexMap& src, ARCS::IndexMap& dst)
+{
+    if (dst.empty()) {
+        dst.swap(src);
+        return ARCS::IndexRuns::countEnds(dst);
+    }
+    size_t numEnds = 0;
+    for (auto& x : src) {
+        ARCS::ScafMap& scafMap = dst[x.first];
+        const size_t n = scafMap.size();
+        for (const auto& end : x.second)
+            scafMap[end.first] += end.second;
+        numEnds += scafMap.size() - n;
+    }
+    src.clear();
+    return numEnds;
+}
+
+/* Add the counts of the barcode multiplicities src to dst, and clear src. */
+static void mergeIndexMultMap(ARCS::IndexMultMap& src,
+        ARCS::IndexMultMap& dst)
+{
+    if (dst.empty()) {
+        dst.swap(src);
+        return;
+    }
+    for (const auto& x : src)
+        dst[x.first] += x.second;
+    src.clear();
+}
+
+/*
+ * Add the counts of the maps of a chunk or thread to imap and
+ * indexMultMap. With --max-memory, write them to a sorted run instead,
+ * so that imap does not grow.
+ */
+static void mergeIndexMaps(ARCS::IndexMap& srcIndexMap, ARCS::IndexMultMap& srcIndexMultMap,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap)
+{
+    if (indexRuns.enabled() && prefilter.pass != PASS_COUNT) {
+        indexRuns.spill(srcIndexMap, srcIndexMultMap);
+        return;
+    }
+    mergeIndexMap(srcIndexMap, imap);
+    mergeIndexMultMap(srcIndexMultMap, indexMultMap);
+}
+
+/* Return whether the file is a regular file. */
+static bool isRegularFile(const std::string& filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/*
+ * Read an uncompressed SAM file, which is mapped into memory, in
+ * chunks that are parsed in parallel. The chunks are split between
+ * different reads, so that the pairs of reads, and the number of
+ * unpaired reads, are the same as when reading the file serially.
+ */
+static void readSAMChunks(const MappedFile& in, unsigned threads,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    const char* data = in.data();
+    const size_t fileSize = in.size();
+
+    // Read the header serially.
+    SequenceHeader header(contigs.empty());
+    size_t headerSize = 0;
+    while (headerSize < fileSize
+            && (data[headerSize] == '@' || data[headerSize] == '\n')) {
+        const char* nl = static_cast<const char*>(
+                memchr(data + headerSize, '\n', fileSize - headerSize));
+        size_t lineEnd = nl != NULL ? nl - data : fileSize;
+        if (lineEnd > headerSize)
+            header.addLine(data + headerSize, data + lineEnd);
+        headerSize = std::min(lineEnd + 1, fileSize);
+    }
+    header.finish(scaffSizeList, contigs);
+
+    // Divide the alignments into chunks of about the same size.
+    const unsigned numChunks = threads;
+    std::vector<size_t> bounds(1, headerSize);
+    std::vector<std::string> nextNames;
+    for (unsigned i = 1; i < numChunks; ++i) {
+        size_t pos = headerSize + (fileSize - headerSize) * i / numChunks;
+        std::string nextName;
+        if (pos <= bounds.back()) {
+            pos = bounds.back();
+            nextName = nextNames.empty() ? std::string() : nextNames.back();
+        } else {
+            pos = findReadBoundary(data, fileSize, pos, nextName);
+        }
+        bounds.push_back(pos);
+        nextNames.push_back(nextName);
+    }
+    bounds.push_back(fileSize);
+    nextNames.push_back(std::string());
+
+    std::vector<ARCS::IndexMap> imaps(numChunks);
+    std::vector<ARCS::IndexMultMap> indexMultMaps(numChunks);
+    std::vector<size_t> countUnpaired(numChunks);
+    std::vector<std::pair<std::string, std::string>> firstUnpaired(numChunks);
+
+#if _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+#endif
+    for (unsigned i = 0; i < numChunks; ++i) {
+        in.willNeed(bounds[i], bounds[i + 1] - bounds[i]);
+        // The header has been read already, so contigs is only read.
+        ARCS::ScaffSizeList unusedScaffSizeList;
+        SequenceHeader unusedHeader(false);
+        AlignmentPairer<SAMRecord> pairer(imaps[i], indexMultMaps[i], contigs, true);
+        readSAM(data + bounds[i], data + bounds[i + 1], pairer, unusedHeader,
+                unusedScaffSizeList, contigs);
+        if (bounds[i + 1] < fileSize)
+            pairer.endChunk(StringSpan(nextNames[i]));
+        countUnpaired[i] = pairer.unpaired();
+        firstUnpaired[i] = pairer.firstUnpaired();
+    }
+
+    // Sum the counts of the chunks in order.
+    size_t totalUnpaired = 0;
+    for (unsigned i = 0; i < numChunks; ++i) {
+        mergeIndexMaps(imaps[i], indexMultMaps[i], imap, indexMultMap);
+        if (totalUnpaired == 0 && countUnpaired[i] > 0)
+            warnUnpaired(StringSpan(firstUnpaired[i].first),
+                    StringSpan(firstUnpaired[i].second));
+        totalUnpaired += countUnpaired[i];
+    }
+    warnUnpairedCount(totalUnpaired);
+}
+
+/* Read the lines of a string. */
+struct StringLineReader
+{
+    const std::string& s;
+    size_t pos;
+    StringLineReader(const std::string& s) : s(s), pos(0) { }
+    bool getline(std::string& line)
+    {
+        if (pos >= s.size())
+            return false;
+        size_t end = s.find('\n', pos);
+        if (end == std::string::npos)
+            end = s.size();
+        line.assign(s, pos, end - pos);
+        pos = end + 1;
+        return true;
+    }
+};
+
+/*
+ * Return the offset of the first line of the run of records at the
+ * end of text that have the same read name, and store that name in
+ * lastName. Return 0 if every record of text has the same read name.
+ */
+static size_t findLastReadStart(const std::string& text, std::string& lastName)
+{
+    lastName.clear();
+    size_t end = text.size();
+    while (end > 0) {
+        size_t start = text.rfind('\n', end - 1);
+        start = start == std::string::npos ? 0 : start + 1;
+        std::string line(text, start, end - start);
+        end = start == 0 ? 0 : start - 1;
+        if (line.empty() || line[0] == '@')
+            continue;
+        StringSpan readName = getReadName(line);
+        if (lastName.empty())
+            lastName = readName.str();
+        else if (readName != lastName)
+            return start + line.size() + 1;
+    }
+    return 0;
+}
+
+/*
+ * Read a stream of SAM records, such as the output of an aligner
+ * piped into /dev/stdin, with a pipeline of threads. The calling
+ * thread reads the stream in large batches, which end between two
+ * reads. Parser threads pair the reads of each batch and count its
+ * barcodes in maps of its own. Between batches, the calling thread
+ * adds the counts of the parsed batches to the IndexMap in the order
+ * of the stream, so that the pipeline uses as many threads as it is
+ * given. The number of batches in flight is bounded, so that the
+ * reader waits for the parsers rather than using memory.
+ */
+class SAMPipeline
+{
+  public:
+    SAMPipeline(std::istream& in, unsigned threads)
+        : in(in), numParsers(std::max(1u, threads - 1)),
+        slots(4 * numParsers), nextRead(0), nextParse(0), nextMerge(0),
+        readDone(false), numEnds(0), countUnpaired(0) { }
+
+    /*
+     * Read the records following the header, which begin with the
+     * line firstLine.
+     */
+    void run(const std::string& firstLine,
+            ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+            ARCS::Contigs& contigs);
+
+  private:
+    /* A batch of SAM records, and the barcode counts of its read pairs */
+    struct Batch
+    {
+        std::string text;
+        /* The read name of the first record of the next batch */
+        std::string nextName;
+        bool last;
+        bool read;
+        bool parsed;
+        ARCS::IndexMap imap;
+        ARCS::IndexMultMap indexMultMap;
+        size_t countUnpaired;
+        std::pair<std::string, std::string> firstUnpaired;
+        Batch() : last(false), read(false), parsed(false), countUnpaired(0) { }
+    };
+
+    /* The size of a batch */
+    static const size_t BATCH_SIZE = 4 << 20;
+
+    /*
+     * Read the next batch into text, beginning with carry, and carry
+     * its last read over to the next batch.
+     * @return whether the end of the stream is reached
+     */
+    bool readBatch(std::string& carry, std::vector<char>& block,
+            std::string& text, std::string& nextName);
+
+    /* Parse the batches. */
+    void parser(ARCS::Contigs& contigs);
+
+    /*
+     * Add the counts of the next batch to the maps. When wait is
+     * false, do not wait for the batch to be parsed.
+     * @return whether a batch was added
+     */
+    bool mergeBatch(bool wait, ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap);
+
+    std::istream& in;
+    unsigned numParsers;
+
+    /* A circular queue of batches, indexed by batch number */
+    std::vector<Batch> slots;
+    size_t nextRead, nextParse, nextMerge;
+    bool readDone;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    /* The number of scaffold ends of the IndexMap, with --max-memory */
+    size_t numEnds;
+    size_t countUnpaired;
+};
+
+bool SAMPipeline::readBatch(std::string& carry, std::vector<char>& block,
+        std::string& text, std::string& nextName)
+{
+    text.clear();
+    text.swap(carry);
+    nextName.clear();
+    bool eof = false;
+    for (;;) {
+        while (!eof && text.size() < BATCH_SIZE) {
+            in.read(block.data(), block.size());
+            text.append(block.data(), in.gcount());
+            eof = in.eof() || !in;
+        }
+        if (eof)
+            return true;
+        // Carry the last read over to the next batch, so that the
+        // records of a read are never split between batches.
+        size_t lastLine = text.rfind('\n');
+        size_t start = lastLine == std::string::npos ? 0
+            : findLastReadStart(text.substr(0, lastLine), nextName);
+        if (start > 0) {
+            carry.assign(text, start, std::string::npos);
+            text.resize(start);
+            return false;
+        }
+        // The batch is a single read. Read more.
+        nextName.clear();
+        in.read(block.data(), block.size());
+        text.append(block.data(), in.gcount());
+        eof = in.eof() || !in;
+    }
+}
+
+void SAMPipeline::parser(ARCS::Contigs& contigs)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cond.wait(lock, [this] { return nextParse < nextRead || readDone; });
+        if (nextParse == nextRead)
+            return;
+        Batch& batch = slots[nextParse++ % slots.size()];
+        lock.unlock();
+
+        // The header has been read already. Ignore any header lines
+        // that follow the first record.
+        AlignmentPairer<SAMRecord> pairer(batch.imap, batch.indexMultMap, contigs, true);
+        StringLineReader lines(batch.text);
+        SAMRecord rec;
+        while (lines.getline(pairer.buffer())) {
+            const std::string& line = pairer.buffer();
+            if (line.empty() || line[0] == '@')
+                continue;
+            rec.parse(line);
+            pairer.add(rec);
+        }
+        if (!batch.last)
+            pairer.endChunk(StringSpan(batch.nextName));
+        batch.countUnpaired = pairer.unpaired();
+        batch.firstUnpaired = pairer.firstUnpaired();
+        std::string().swap(batch.text);
+
+        lock.lock();
+        batch.parsed = true;
+        cond.notify_all();
+    }
+}
+
+bool SAMPipeline::mergeBatch(bool wait,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (nextMerge == nextRead)
+        return false;
+    Batch& batch = slots[nextMerge % slots.size()];
+    if (wait)
+        cond.wait(lock, [&batch] { return batch.parsed; });
+    else if (!batch.parsed)
+        return false;
+    lock.unlock();
+
+    // With --max-memory, spill the maps to a sorted run when they are full.
+    numEnds += mergeIndexMap(batch.imap, imap);
+    mergeIndexMultMap(batch.indexMultMap, indexMultMap);
+    if (indexRuns.full(imap, numEnds, indexMultMap)) {
+        indexRuns.spill(imap, indexMultMap);
+        numEnds = 0;
+    }
+    if (countUnpaired == 0 && batch.countUnpaired > 0)
+        warnUnpaired(StringSpan(batch.firstUnpaired.first),
+                StringSpan(batch.firstUnpaired.second));
+    countUnpaired += batch.countUnpaired;
+
+    lock.lock();
+    batch.parsed = false;
+    ++nextMerge;
+    return true;
+}
+
+void SAMPipeline::run(const std::string& firstLine,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::Contigs& contigs)
+{
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < numParsers; ++i)
+        threads.push_back(std::thread(&SAMPipeline::parser, this, std::ref(contigs)));
+
+    numEnds = indexRuns.enabled() ? ARCS::IndexRuns::countEnds(imap) : 0;
+    std::string carry = firstLine + '\n';
+    std::vector<char> block(BATCH_SIZE);
+    std::string text, nextName;
+    for (bool eof = false; !eof;) {
+        eof = readBatch(carry, block, text, nextName);
+
+        // Add the counts of the batches that are parsed, and wait for
+        // the oldest batch when the queue is full.
+        while (mergeBatch(false, imap, indexMultMap))
+            ;
+        while (nextRead == nextMerge + slots.size())
+            mergeBatch(true, imap, indexMultMap);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Batch& batch = slots[nextRead % slots.size()];
+        batch = Batch();
+        batch.text.swap(text);
+        batch.nextName.swap(nextName);
+        batch.last = eof;
+        batch.read = true;
+        ++nextRead;
+        cond.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        readDone = true;
+        cond.notify_all();
+    }
+
+    while (mergeBatch(true, imap, indexMultMap))
+        ;
+    for (auto& t : threads)
+        t.join();
+    warnUnpairedCount(countUnpaired);
+}
+
+/*
+ * Read a SAM stream with a pipeline of the specified number of threads.
+ */
+static void readSAMPipeline(std::istream& in, unsigned threads,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    // Read the header serially.
+    SequenceHeader header(contigs.empty());
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty())
+            continue;
+        if (line[0] != '@')
+            break;
+        header.addLine(line);
+    }
+    header.finish(scaffSizeList, contigs);
+    if (line.empty() || line[0] == '@')
+        return;
+
+    SAMPipeline pipeline(in, threads);
+    pipeline.run(line, imap, indexMultMap, contigs);
+}
+
+/*
+ * Read BAM file, if sequence identity greater than threashold
+ * update indexMap. IndexMap also stores information about
+ * contig number index algins with and counts.
+ * Uncompress BAM and bgzip input using the specified number of threads,
+ * or parse an uncompressed SAM file in that many chunks.
+ */
+void readBAM(const std::string bamName, unsigned threads,
+        ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    if (endsWith(bamName, ".bam")) {
+        readBAMBinary(bamName, threads, imap, indexMultMap, scaffSizeList, contigs);
+        return;
+    }
 
-            if (params.verbose && linecount % 10000000 == 0)
-                std::cout << "On line " << linecount << std::endl;
+    /* Uncompress a SAM file compressed with bgzip in parallel. */
+    if (endsWith(bamName, ".gz") && BGZFReader::isBGZF(bamName)) {
+        BGZFReader in;
+        in.open(bamName, threads);
+        if (in.eof()) {
+            std::cerr << "error: alignments file is empty: " << bamName << '\n';
+            exit(EXIT_FAILURE);
+        }
+        readSAM(in, imap, indexMultMap, scaffSizeList, contigs);
+        return;
+    }
+
+    /*
+     * Map an uncompressed SAM file into memory, whatever its name. A
+     * file that begins with the magic number of gzip, such as a BAM or
+     * bgzip file with another suffix, is read as a stream.
+     */
+    MappedFile mapped;
+    if (!isCompressed(bamName) && mapped.open(bamName)
+            && (mapped.size() == 0 || mapped.data()[0] != '\x1f')) {
+        if (mapped.size() == 0) {
+            std::cerr << "error: alignments file is empty: " << bamName << '\n';
+            exit(EXIT_FAILURE);
+        }
+        if (threads > 1 && !params.coordinate_sorted) {
+            /* Parse the file in parallel. */
+            readSAMChunks(mapped, threads, imap, indexMultMap, scaffSizeList, contigs);
+        } else {
+            SequenceHeader header(contigs.empty());
+            AlignmentPairer<SAMRecord> pairer(imap, indexMultMap, contigs);
+            readSAM(mapped.data(), mapped.data() + mapped.size(), pairer,
+                    header, scaffSizeList, contigs);
+            pairer.finish();
+        }
+        return;
+    }
+
+    mapped.close();
+
+    /* Otherwise read the SAM file as a stream, such as a pipe. */
+    std::ifstream bamName_stream;
+    bamName_stream.open(bamName.c_str());
+    assert_good(bamName_stream, bamName);
+    if (bamName_stream.peek() == EOF) {
+        std::cerr << "error: alignments file is empty: " << bamName << '\n';
+        exit(EXIT_FAILURE);
+    }
 
-        }
-        assert(bamName_stream);
+    if (threads > 1 && !params.coordinate_sorted) {
+        /* Parse a stream, such as /dev/stdin, with a pipeline. */
+        readSAMPipeline(bamName_stream, threads, imap, indexMultMap, scaffSizeList, contigs);
+    } else {
+        StreamLineReader in(bamName_stream);
+        readSAM(in, imap, indexMultMap, scaffSizeList, contigs);
     }
 
-    /* Close BAM file */
+    /* Close SAM file */
     assert_eof(bamName_stream, bamName);
     bamName_stream.close();
-
-    if (countUnpaired > 0)
-        std::cerr << "Warning: Skipped " << countUnpaired << " unpaired reads. Read pairs should be consecutive in the SAM/BAM file.\n";
 }
 
 /**
@@ -442,32 +1723,198 @@ static std::vector<std::string> readFof(const std::string& fofName)
     return filenames;
 }
 
+/*
+ * Read the SAM/BAM header of each file. Add the sequences of the first
+ * header to scaffSizeList and contigs, unless contigs is already populated,
+ * and check that the sequences of the remaining headers match.
+ */
+static void readHeaders(const std::vector<std::string>& bamNames,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
+{
+    for (const auto& bamName : bamNames) {
+        SequenceHeader header(contigs.empty());
+        if (endsWith(bamName, ".bam")) {
+            BAMReader in(bamName);
+            for (const auto& ref : in.references())
+                header.addSequence(ref.first, ref.second);
+            header.finish(scaffSizeList, contigs);
+            continue;
+        }
+
+        BGZFReader bgzf;
+        std::ifstream stream;
+        const bool isBGZF = endsWith(bamName, ".gz")
+            && BGZFReader::isBGZF(bamName);
+        if (isBGZF)
+            bgzf.open(bamName);
+        else
+            stream.open(bamName.c_str());
+        for (std::string line; isBGZF ? bgzf.getline(line)
+                : (bool)std::getline(stream, line);) {
+            if (line.empty())
+                continue;
+            if (line[0] != '@')
+                break;
+            header.addLine(line);
+        }
+        header.finish(scaffSizeList, contigs);
+    }
+}
+
+/* Return whether each of the files is a regular file. */
+static bool areRegularFiles(const std::vector<std::string>& filenames)
+{
+    for (const auto& filename : filenames)
+        if (!isRegularFile(filename))
+            return false;
+    return true;
+}
+
 /**
  * Read the BAM files.
+ * When using multiple threads, read several files concurrently.
+ * Each thread counts the barcodes of its files in its own maps,
+ * which are then summed, so that the result is identical to reading
+ * the files one after the other.
  */
-void readBAMS(const std::vector<std::string> bamNames, ARCS::IndexMap& imap, std::unordered_map<std::string, int>& indexMultMap,
-        ARCS::ScaffSizeList& scaffSizeList, ARCS::ScaffSizeMap& scaffSizeMap)
+void readBAMS(const std::vector<std::string> bamNames, ARCS::IndexMap& imap, ARCS::IndexMultMap& indexMultMap,
+        ARCS::ScaffSizeList& scaffSizeList, ARCS::Contigs& contigs)
 {
     assert(!bamNames.empty());
-    for (const auto& bamName : bamNames) {
-        if (params.verbose)
-            std::cout << "Reading alignments: " << bamName << std::endl;
-        readBAM(bamName, imap, indexMultMap, scaffSizeList, scaffSizeMap);
+    unsigned fileThreads = std::min<size_t>(params.threads, bamNames.size());
+#if !_OPENMP
+    fileThreads = 1;
+#endif
+    // Files that are not regular files, such as /dev/stdin,
+    // cannot be opened twice to read their header first.
+    if (fileThreads <= 1 || !areRegularFiles(bamNames)) {
+        for (const auto& bamName : bamNames) {
+            if (params.verbose)
+                std::cout << "Reading alignments: " << bamName << std::endl;
+            readBAM(bamName, params.threads, imap, indexMultMap,
+                    scaffSizeList, contigs);
+            contigs.addUnknown();
+        }
+        return;
+    }
+
+    // Read the headers first, so that the sequence lengths are known
+    // before reading the alignments of any file.
+    readHeaders(bamNames, scaffSizeList, contigs);
+
+    // Divide the remaining threads among the files to uncompress them.
+    const unsigned uncompressThreads = std::max(1u, params.threads / fileThreads);
+
+    std::vector<ARCS::IndexMap> imaps(fileThreads);
+    std::vector<ARCS::IndexMultMap> indexMultMaps(fileThreads);
+
+#if _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(fileThreads)
+#endif
+    for (size_t i = 0; i < bamNames.size(); ++i) {
+#if _OPENMP
+        const unsigned tid = omp_get_thread_num();
+#else
+        const unsigned tid = 0;
+#endif
+        if (params.verbose) {
+#if _OPENMP
+            #pragma omp critical(cout)
+#endif
+            std::cout << "Reading alignments: " << bamNames[i] << std::endl;
+        }
+        // The headers have been read already, so that readBAM only
+        // checks the header of each file against contigs.
+        ARCS::ScaffSizeList unusedScaffSizeList;
+        readBAM(bamNames[i], uncompressThreads, imaps[tid], indexMultMaps[tid],
+                unusedScaffSizeList, contigs);
+    }
+
+    // Sum the counts of the threads in order.
+    for (unsigned tid = 0; tid < fileThreads; ++tid) {
+        mergeIndexMaps(imaps[tid], indexMultMaps[tid], imap, indexMultMap);
     }
+    contigs.addUnknown();
 }
 
-/** Count barcodes. */
-static size_t countBarcodes(ARCS::IndexMap& imap, const std::unordered_map<std::string, int>& indexMultMap)
+/*
+ * Freeze the IndexMap into the IndexTable itable, and clear the
+ * IndexMap. Renumber the contigs with newIDs, the new ID of each
+ * contig indexed by its old ID.
+ */
+static void freezeIndexMap(ARCS::IndexMap& imap, const ARCS::IndexMultMap& indexMultMap,
+        const std::vector<ARCS::ContigID>& newIDs, ARCS::IndexTable& itable)
+{
+    // Each contig of the ScafMap has an entry for both of its ends.
+    size_t numContigs = 0;
+    itable.barcodes.reserve(imap.size());
+    for (const auto& it : imap) {
+        itable.barcodes.push_back(it.first);
+        numContigs += it.second.size() / 2;
+    }
+    std::sort(itable.barcodes.begin(), itable.barcodes.end());
+
+    itable.multiplicities.reserve(itable.barcodes.size());
+    itable.offsets.reserve(itable.barcodes.size() + 1);
+    itable.contigs.reserve(numContigs);
+    itable.offsets.push_back(0);
+    for (BarcodeID barcode : itable.barcodes) {
+        auto it = imap.find(barcode);
+        assert(it != imap.end());
+        itable.multiplicities.push_back(indexMultMap.at(barcode));
+        const size_t first = itable.contigs.size();
+        for (const auto& x : it->second) {
+            ARCS::ContigID id = newIDs[x.first.first];
+            if (itable.contigs.size() == first || itable.contigs.back().contig != id) {
+                ARCS::ContigEndCounts counts = { id, 0, 0 };
+                itable.contigs.push_back(counts);
+            }
+            if (x.first.second)
+                itable.contigs.back().head = x.second;
+            else
+                itable.contigs.back().tail = x.second;
+        }
+        std::sort(itable.contigs.begin() + first, itable.contigs.end(),
+                [](const ARCS::ContigEndCounts& a, const ARCS::ContigEndCounts& b) {
+                    return a.contig < b.contig;
+                });
+        itable.offsets.push_back(itable.contigs.size());
+        // Free the memory of the IndexMap as the table grows.
+        imap.erase(it);
+    }
+    assert(imap.empty());
+}
+
+/*
+ * Erase the barcodes that the sketch of --barcode-sketch has not given
+ * an exact count, which have fewer reads than the minimum of -m.
+ */
+static void eraseUncountedBarcodes(ARCS::IndexMap& imap, const ARCS::IndexMultMap& indexMultMap)
+{
+    for (auto it = imap.begin(); it != imap.end();) {
+        if (indexMultMap.count(it->first) == 0)
+            it = imap.erase(it);
+        else
+            ++it;
+    }
+}
+
+/**
+ * Count barcodes. The IndexMultMap has the barcodes of numBarcodes
+ * whose multiplicities may be in the range of params.
+ */
+static size_t countBarcodes(const ARCS::IndexTable& itable, const ARCS::IndexMultMap& indexMultMap,
+        size_t numBarcodes, const ARCS::ArcsParams& params, std::ostream& out)
 {
     size_t barcodeCount = 0;
     for (auto x : indexMultMap)
         if (x.second >= params.min_mult && x.second <= params.max_mult)
             ++barcodeCount;
 
-    std::cout
-        << "{ \"All_barcodes_unfiltered\":" << indexMultMap.size()
+    out
+        << "{ \"All_barcodes_unfiltered\":" << numBarcodes
         << ", \"All_barcodes_filtered\":" << barcodeCount
-        << ", \"Scaffold_end_barcodes\":" << imap.size()
+        << ", \"Scaffold_end_barcodes\":" << itable.size()
         << ", \"Min_barcode_reads_threshold\":" << params.min_mult
         << ", \"Max_barcode_reads_threshold\":" << params.max_mult
         << " }\n";
@@ -482,19 +1929,113 @@ float normalEstimation(int x, float p, int n) {
     return 0.5 * (1 + std::erf((x - mean)/(sd * std::sqrt(2))));
 }
 
+/* Return whether x of n is significant by the normal approximation. */
+static bool normalSignificant(int x, int n, float errorPercent)
+{
+    return 1 - normalEstimation(x, 0.5, n) < errorPercent;
+}
+
+/*
+ * The test of whether the largest number x of n links or read pairs
+ * differs significantly from a uniform distribution (p=0.5).
+ * The test is monotonic in x, so that it is tabulated as the least
+ * significant x for each n up to a bound, and is then a comparison.
+ * The exact test is the binomial P(X >= x) of the table, and above
+ * the bound both tests are the normal approximation.
+ */
+class SignificanceTable
+{
+  public:
+    SignificanceTable(float errorPercent, bool exact, unsigned bound)
+        : m_errorPercent(errorPercent)
+    {
+        m_minSignificant.reserve(bound);
+        for (unsigned n = 0; n < bound; ++n)
+            m_minSignificant.push_back(exact ? minBinomial(n) : minNormal(n));
+    }
+
+    /* Return whether x of n is significant. */
+    bool operator()(int x, int n) const
+    {
+        if (n >= 0 && size_t(n) < m_minSignificant.size())
+            return x >= m_minSignificant[n];
+        return normalSignificant(x, n, m_errorPercent);
+    }
+
+  private:
+    /* The value of x that is never significant */
+    static const int NEVER = INT_MAX;
+
+    /* Return the least x of n that is significant by the normal approximation. */
+    int minNormal(int n) const
+    {
+        int hi = 1;
+        while (!normalSignificant(hi, n, m_errorPercent)) {
+            if (hi > INT_MAX / 2)
+                return NEVER;
+            hi *= 2;
+        }
+        int lo = hi / 2;
+        while (lo + 1 < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (normalSignificant(mid, n, m_errorPercent))
+                hi = mid;
+            else
+                lo = mid;
+        }
+        return hi;
+    }
+
+    /* Return the least x of n for which the binomial P(X >= x) is significant. */
+    int minBinomial(int n) const
+    {
+        // The tail beyond 13 standard deviations is negligible.
+        int x = std::min<int>(n, std::ceil(n / 2.0 + 6.5 * std::sqrt(n)));
+        double p = std::exp(std::lgamma(n + 1.0) - std::lgamma(x + 1.0)
+                - std::lgamma(n - x + 1.0) - n * std::log(2.0));
+        double tail = 0;
+        for (; x >= 0 && tail + p < m_errorPercent; --x) {
+            tail += p;
+            p *= double(x) / (n - x + 1);
+        }
+        return tail < m_errorPercent ? x + 1 : NEVER;
+    }
+
+    float m_errorPercent;
+    std::vector<int> m_minSignificant;
+};
+
+/*
+ * Return the significance table of the parameters. The tables are
+ * built when first used, and shared by the parameter sets of a sweep.
+ */
+static const SignificanceTable& significanceTable(const ARCS::ArcsParams& params)
+{
+    typedef std::tuple<float, bool, unsigned> Key;
+    static std::map<Key, std::unique_ptr<SignificanceTable>> tables;
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<SignificanceTable>& table = tables[Key(params.error_percent,
+            params.binomial, params.significance_table)];
+    if (!table)
+        table.reset(new SignificanceTable(params.error_percent,
+                    params.binomial, params.significance_table));
+    return *table;
+}
+
 /*
  * Based on number of read pairs that align to the
  * head or tail of scaffold, determine if is significantly
  * different from a uniform distribution (p=0.5)
  */
-std::pair<bool, bool> headOrTail(int head, int tail) {
+std::pair<bool, bool> headOrTail(int head, int tail, const ARCS::ArcsParams& params,
+        const SignificanceTable& significant) {
     int max = std::max(head, tail);
     int sum = head + tail;
     if (sum < params.min_reads) {
         return std::pair<bool, bool> (false, false);
     }
-    float normalCdf = normalEstimation(max, 0.5, sum);
-    if (1 - normalCdf < params.error_percent) {
+    if (significant(max, sum)) {
         bool isHead = (max == head);
         return std::pair<bool, bool> (true, isHead);
     } else {
@@ -503,66 +2044,48 @@ std::pair<bool, bool> headOrTail(int head, int tail) {
 }
 
 /*
- * Iterate through IndexMap and for every pair of scaffolds
+ * Iterate through IndexTable and for every pair of scaffolds
  * that align to the same index, store in PairMap. PairMap
  * is a map with a key of pairs of saffold names, and value
  * of number of links between the pair. (Each link is one index).
+ *
+ * The end of each contig of an index is determined once, and the
+ * links are counted by the product of the incidence matrix of those
+ * contig ends and indices with its transpose.
  */
-void pairContigs(ARCS::IndexMap& imap, ARCS::PairMap& pmap, std::unordered_map<std::string, int>& indexMultMap) {
-
-    /* Iterate through each index in IndexMap */
-    for(auto it = imap.begin(); it != imap.end(); ++it) {
-
-        /* Get index multiplicity from indexMultMap */
-        std::string index = it->first;
-        int indexMult = indexMultMap[index];
-
-        if (indexMult >= params.min_mult && indexMult <= params.max_mult) {
-
-           /* Iterate through all the scafNames in ScafMap */
-            for (auto o = it->second.begin(); o != it->second.end(); ++o) {
-                for (auto p = it->second.begin(); p != it->second.end(); ++p) {
-                    std::string scafA, scafB;
-                    bool scafAflag, scafBflag;
-                    std::tie (scafA, scafAflag) = o->first;
-                    std::tie (scafB, scafBflag) = p->first;
-
-                    /* Only insert into pmap if scafA < scafB to avoid duplicates */
-                    if (scafA < scafB && scafAflag && scafBflag) {
-                        bool validA, validB, scafAhead, scafBhead;
-
-                        std::tie(validA, scafAhead) = headOrTail(it->second[ScaffoldEnd(scafA, true)], it->second[ScaffoldEnd(scafA, false)]);
-                        std::tie(validB, scafBhead) = headOrTail(it->second[ScaffoldEnd(scafB, true)], it->second[ScaffoldEnd(scafB, false)]);
-
-                        if (validA && validB) {
-                            std::pair<std::string, std::string> pair (scafA, scafB);
-                            if (pmap.count(pair) == 0)
-                                pmap[pair].resize(4);
-                            // Head - Head
-                            if (scafAhead && scafBhead)
-                                pmap[pair][0]++;
-                            // Head - Tail
-                            else if (scafAhead && !scafBhead)
-                                pmap[pair][1]++;
-                            // Tail - Head
-                            else if (!scafAhead && scafBhead)
-                                pmap[pair][2]++;
-                            // Tail - Tail
-                            else if (!scafAhead && !scafBhead)
-                                pmap[pair][3]++;
-                        }
-                    }
-                }
-            }
-        }
-    }
+void pairContigs(const ARCS::IndexTable& itable, const ARCS::ArcsParams& params,
+        ARCS::PairMap& pmap) {
+
+    const SignificanceTable& significant = significanceTable(params);
+    ARCS::SharedBarcodes shared(itable, params,
+            [&](const ARCS::ContigEndCounts& counts) -> unsigned {
+                bool valid, isHead;
+                std::tie(valid, isHead) = headOrTail(counts.head, counts.tail,
+                        params, significant);
+                return !valid ? 0
+                    : isHead ? ARCS::SharedBarcodes::HEAD : ARCS::SharedBarcodes::TAIL;
+            });
+
+    /*
+     * createGraph skips the pairs with fewer than min_links links.
+     * The TSV and the summary of a sweep count them.
+     */
+    const unsigned minLinks = params.tsv_name.empty() && params.sweep.empty()
+        ? std::max(params.min_links, 0) : 0;
+    std::vector<ARCS::PairMap::Entry> pairs;
+    shared.multiply(ARCS::SharedBarcodes::threads(params),
+            [minLinks](ARCS::ContigID, ARCS::ContigID,
+                    const ARCS::PairMap::Counts& counts) {
+                return *std::max_element(counts.begin(), counts.end()) >= minLinks;
+            }, pairs);
+    pmap.assign(pairs);
 }
 
 /*
  * Return the max value and its index position
  * in the vector
  */
-std::pair<unsigned, unsigned> getMaxValueAndIndex(const ARCS::PairMap::value_type::second_type& array) {
+std::pair<unsigned, unsigned> getMaxValueAndIndex(const ARCS::PairMap::Counts& array) {
     unsigned max = 0;
     unsigned index = 0;
     for (unsigned i = 0; i < array.size(); ++i) {
@@ -578,12 +2101,12 @@ std::pair<unsigned, unsigned> getMaxValueAndIndex(const ARCS::PairMap::value_typ
  * Return true if the link orientation with the max support
  * is dominant
  */
-bool checkSignificance(int max, int second) {
+bool checkSignificance(int max, int second, const ARCS::ArcsParams& params,
+        const SignificanceTable& significant) {
     if (max < params.min_links) {
         return false;
     }
-    float normalCdf = normalEstimation(max, 0.5, second);
-    return (1 - normalCdf < params.error_percent);
+    return significant(max, second);
 }
 
 /*
@@ -592,17 +2115,18 @@ bool checkSignificance(int max, int second) {
  * between the scafNames.
  * VidVdes is a mapping of vertex descriptors to scafNames (vertex id).
  */
-void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g) {
+void createGraph(const ARCS::PairMap& pmap, const ARCS::ArcsParams& params, ARCS::Graph& g) {
 
     ARCS::VidVdesMap vmap;
+    const SignificanceTable& significant = significanceTable(params);
 
     ARCS::PairMap::const_iterator it;
     for(it = pmap.begin(); it != pmap.end(); ++it) {
-        std::string scaf1, scaf2;
-        std::tie (scaf1, scaf2) = it->first;
+        ARCS::ContigID scaf1, scaf2;
+        std::tie (scaf1, scaf2) = it->pair();
 
         unsigned max, index;
-        const auto& count = it->second;
+        const auto& count = it->counts;
         std::tie(max, index) = getMaxValueAndIndex(count);
 
         unsigned second = 0;
@@ -612,7 +2136,7 @@ void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g) {
         }
 
         /* Only insert edge if orientation with max links is dominant */
-        if (checkSignificance(max, second)) {
+        if (checkSignificance(max, second, params, significant)) {
 
             /* If scaf1 is not a node in the graph, add it */
             if (vmap.count(scaf1) == 0) {
@@ -644,14 +2168,15 @@ void createGraph(const ARCS::PairMap& pmap, ARCS::Graph& g) {
 /*
  * Write out the boost graph in a .dot file.
  */
-void writeGraph(const std::string& graphFile_dot, ARCS::Graph& g)
+void writeGraph(const std::string& graphFile_dot, ARCS::Graph& g,
+        const ARCS::Contigs& contigs)
 {
     assert(!graphFile_dot.empty());
 
 	std::ofstream out(graphFile_dot.c_str());
 	assert(out);
 
-	ARCS::VertexPropertyWriter<ARCS::Graph> vpWriter(g);
+	ARCS::VertexPropertyWriter<ARCS::Graph> vpWriter(g, contigs);
 	ARCS::EdgePropertyWriter<ARCS::Graph> epWriter(g);
 
 	boost::write_graphviz(out, g, vpWriter, epWriter);
@@ -687,24 +2212,26 @@ void removeDegreeNodes(ARCS::Graph& g, int max_degree) {
  * Remove nodes that have a degree greater than max_degree
  * Write graph
  */
-void writePostRemovalGraph(ARCS::Graph& g, const std::string graphFile) {
+void writePostRemovalGraph(ARCS::Graph& g, const std::string graphFile,
+        const ARCS::Contigs& contigs, const ARCS::ArcsParams& params, std::ostream& out) {
     assert(!graphFile.empty());
 
     if (params.max_degree != 0) {
-        std::cout << "      Deleting nodes with degree > " << params.max_degree <<"... \n";
+        out << "      Deleting nodes with degree > " << params.max_degree <<"... \n";
         removeDegreeNodes(g, params.max_degree);
     } else {
-        std::cout << "      Max Degree (-d) set to: " << params.max_degree << ". Will not delete any vertices from graph.\n";
+        out << "      Max Degree (-d) set to: " << params.max_degree << ". Will not delete any vertices from graph.\n";
     }
 
-    std::cout << "      Writing graph file to " << graphFile << "...\n";
-    writeGraph(graphFile, g);
+    out << "      Writing graph file to " << graphFile << "...\n";
+    writeGraph(graphFile, g, contigs);
 }
 
 /*
  * Construct an ABySS distance estimate graph from a boost graph.
  */
-void createAbyssGraph(const ARCS::ScaffSizeList& scaffSizes, const ARCS::Graph& gin, DistGraph& gout) {
+void createAbyssGraph(const ARCS::ScaffSizeList& scaffSizes, const ARCS::Contigs& contigs,
+        const ARCS::Graph& gin, const ARCS::ArcsParams& params, DistGraph& gout) {
     // Add the vertices.
     for (const auto& it : scaffSizes) {
         vertex_property<DistGraph>::type vp;
@@ -716,8 +2243,10 @@ void createAbyssGraph(const ARCS::ScaffSizeList& scaffSizes, const ARCS::Graph&
     // Add the edges.
     for (const auto ein : boost::make_iterator_range(boost::edges(gin))) {
         const auto einp = gin[ein];
-        const auto u = find_vertex(gin[source(ein, gin)].id, einp.orientation < 2, gout);
-        const auto v = find_vertex(gin[target(ein, gin)].id, einp.orientation % 2, gout);
+        const auto u = find_vertex(std::string(contigs.name(gin[source(ein, gin)].id)),
+                einp.orientation < 2, gout);
+        const auto v = find_vertex(std::string(contigs.name(gin[target(ein, gin)].id)),
+                einp.orientation % 2, gout);
 
         edge_property<DistGraph>::type ep;
         ep.distance = params.gap;
@@ -757,31 +2286,72 @@ void writeAbyssGraph(const std::string& path, const DistGraph& g) {
     assert_good(out, path);
 }
 
+/* Barcodes and their numbers of reads */
+typedef std::vector<std::pair<std::string, unsigned>> SortedBarcodeCounts;
+
+/* Sort the barcodes by their counts and then their sequence, and write them. */
+static void writeSortedBarcodeCounts(std::ostream& f, const std::string& tsvFile,
+        SortedBarcodeCounts& sorted)
+{
+    sort(sorted.begin(), sorted.end(),
+            [](const SortedBarcodeCounts::value_type& a,
+                const SortedBarcodeCounts::value_type& b) {
+                return a.second != b.second ? a.second > b.second : a.first < b.first;
+            });
+    for (auto x : sorted)
+        f << x.first << '\t' << x.second << '\n';
+    assert_good(f, tsvFile);
+}
+
 /** Write a TSV file of the number of reads per barcode.
  * - Barcode: the barcode
  * - Reads: the number of reads
  */
 void writeBarcodeCountsTSV(
         const std::string& tsvFile,
-        const std::unordered_map<std::string, int>& indexMultMap)
+        const ARCS::IndexMultMap& indexMultMap)
 {
     assert(!tsvFile.empty());
 
-    // Sort the barcodes by their counts and then their sequence.
-    typedef std::vector<std::pair<std::string, unsigned>> Sorted;
-    Sorted sorted(indexMultMap.begin(), indexMultMap.end());
-    sort(sorted.begin(), sorted.end(),
-            [](const Sorted::value_type& a, const Sorted::value_type& b) {
-                return a.second != b.second ? a.second > b.second : a.first < b.first;
-            });
+    SortedBarcodeCounts sorted;
+    sorted.reserve(indexMultMap.size());
+    for (const auto& x : indexMultMap)
+        sorted.push_back(std::make_pair(barcodeCodec.decode(x.first), x.second));
 
     std::ofstream f(tsvFile);
     assert_good(f, tsvFile);
     f << "Barcode\tReads\n";
     assert_good(f, tsvFile);
-    for (auto x : sorted)
-        f << x.first << '\t' << x.second << '\n';
+    writeSortedBarcodeCounts(f, tsvFile, sorted);
+}
+
+/**
+ * Write the TSV file of the number of reads per barcode from the
+ * multiplicities saved by the merge of the sorted runs, sorting a
+ * batch of the barcodes at a time within the memory limit.
+ */
+static void writeBarcodeCountsTSV(
+        const std::string& tsvFile,
+        ARCS::IndexRuns& runs)
+{
+    assert(!tsvFile.empty());
+
+    std::ofstream f(tsvFile);
+    assert_good(f, tsvFile);
+    f << "Barcode\tReads\n";
     assert_good(f, tsvFile);
+
+    // A barcode and its count use about 64 bytes.
+    const size_t batchSize = std::max<size_t>(1 << 16, params.max_memory / 2 / 64);
+    SortedBarcodeCounts sorted;
+    runs.forEachCount(batchSize,
+            [&](const std::vector<std::pair<BarcodeID, int>>& batch) {
+                sorted.clear();
+                sorted.reserve(batch.size());
+                for (const auto& x : batch)
+                    sorted.push_back(std::make_pair(barcodeCodec.decode(x.first), x.second));
+                writeSortedBarcodeCounts(f, tsvFile, sorted);
+            });
 }
 
 /** Write a TSV file to calculate a hypergeometric test.
@@ -793,21 +2363,21 @@ void writeBarcodeCountsTSV(
  */
 void writeTSV(
         const std::string& tsvFile,
-        const ARCS::IndexMap& imap,
+        const ARCS::IndexTable& itable,
         const ARCS::PairMap& pmap,
-        size_t barcodeCount)
+        const ARCS::Contigs& contigs,
+        size_t barcodeCount,
+        const ARCS::ArcsParams& params)
 {
     assert(!tsvFile.empty());
 
     // Count the number of barcodes seen per scaffold end.
     std::unordered_map<ScaffoldEnd, unsigned, HashScaffoldEnd> barcodes_per_scaffold_end;
-    for (const auto& it : imap) {
-        for (const auto& scaffold_count : it.second) {
-            const auto& scaffold = scaffold_count.first;
-            const auto& count = scaffold_count.second;
-            if (count >= params.min_reads)
-               ++barcodes_per_scaffold_end[scaffold];
-        }
+    for (const auto& counts : itable.contigs) {
+        if (counts.head >= params.min_reads)
+            ++barcodes_per_scaffold_end[ScaffoldEnd(counts.contig, true)];
+        if (counts.tail >= params.min_reads)
+            ++barcodes_per_scaffold_end[ScaffoldEnd(counts.contig, false)];
     }
 
     std::ofstream f(tsvFile);
@@ -815,26 +2385,25 @@ void writeTSV(
     f << "U\tV\tBest_orientation\tShared_barcodes\tU_barcodes\tV_barcodes\tAll_barcodes\n";
     assert_good(f, tsvFile);
     for (const auto& it : pmap) {
-        const auto& u = it.first.first;
-        const auto& v = it.first.second;
-        const auto& counts = it.second;
-        assert(!counts.empty());
+        ARCS::ContigID u, v;
+        std::tie(u, v) = it.pair();
+        const auto& counts = it.counts;
         unsigned max_counts = *std::max_element(counts.begin(), counts.end());
         for (unsigned i = 0; i < counts.size(); ++i) {
             if (counts[i] == 0)
                 continue;
             bool usense = i < 2;
             bool vsense = i % 2;
-            f << u << (usense ? '-' : '+')
-                << '\t' << v << (vsense ? '-' : '+')
+            f << contigs.name(u) << (usense ? '-' : '+')
+                << '\t' << contigs.name(v) << (vsense ? '-' : '+')
                 << '\t' << (counts[i] == max_counts ? "T" : "F")
                 << '\t' << counts[i]
                 << '\t' << barcodes_per_scaffold_end[std::make_pair(u, usense)]
                 << '\t' << barcodes_per_scaffold_end[std::make_pair(v, !vsense)]
                 << '\t' << barcodeCount
                 << '\n';
-            f << v << (vsense ? '+' : '-')
-                << '\t' << u << (usense ? '+' : '-')
+            f << contigs.name(v) << (vsense ? '+' : '-')
+                << '\t' << contigs.name(u) << (usense ? '+' : '-')
                 << '\t' << (counts[i] == max_counts ? "T" : "F")
                 << '\t' << counts[i]
                 << '\t' << barcodes_per_scaffold_end[std::make_pair(v, !vsense)]
@@ -846,6 +2415,14 @@ void writeTSV(
     assert_good(f, tsvFile);
 }
 
+/** Return the current time as ctime does, safely with several threads. */
+static std::string now()
+{
+    std::time_t t = time(NULL);
+    char buf[26];
+    return ctime_r(&t, buf);
+}
+
 /** Return NA if the specified string is empty, and the string itself otherwise. */
 static const char* maybeNA(const std::string& s)
 {
@@ -857,45 +2434,272 @@ static const char* maybeNA(const std::string& s)
  * barcodes between contig ends
  */
 static inline void calcDistanceEstimates(
-    const ARCS::IndexMap& imap,
-    const std::unordered_map<std::string, int> &indexMultMap,
-    const ARCS::ContigToLength& contigToLength,
-    ARCS::Graph& g)
+    const ARCS::IndexTable& itable,
+    const ARCS::Contigs& contigs,
+    const ARCS::ArcsParams& params,
+    ARCS::Graph& g,
+    std::ostream& out)
 {
-    std::time_t rawtime;
+    const ARCS::ContigToLength& contigToLength = contigs.lengths();
 
-    time(&rawtime);
-    std::cout << "\n\t=> Measuring intra-contig distances / shared barcodes... "
-        << ctime(&rawtime);
+    out << "\n\t=> Measuring intra-contig distances / shared barcodes... "
+        << now();
     DistSampleMap distSamples;
-    calcDistSamples(imap, contigToLength, indexMultMap, params, distSamples);
+    calcDistSamples(itable, contigToLength, params, distSamples);
 
-    time(&rawtime);
-    std::cout << "\n\t=> Writing intra-contig distance samples to TSV... "
-        << ctime(&rawtime);
-    writeDistSamplesTSV(params.dist_samples_tsv, distSamples);
+    out << "\n\t=> Writing intra-contig distance samples to TSV... "
+        << now();
+    writeDistSamplesTSV(params.dist_samples_tsv, distSamples, contigs);
 
-    time(&rawtime);
-    std::cout << "\n\t=> Building Jaccard to distance map... "
-        << ctime(&rawtime);
+    out << "\n\t=> Building Jaccard to distance map... "
+        << now();
     JaccardToDist jaccardToDist;
     buildJaccardToDist(distSamples, jaccardToDist);
 
-    time(&rawtime);
-    std::cout << "\n\t=> Calculating barcode stats for scaffold pairs... "
-        << ctime(&rawtime);
+    out << "\n\t=> Calculating barcode stats for scaffold pairs... "
+        << now();
     PairToBarcodeStats pairToStats;
-    buildPairToBarcodeStats(imap, indexMultMap, contigToLength, params, pairToStats);
+    buildPairToBarcodeStats(itable, contigToLength, params, g, pairToStats);
 
-    time(&rawtime);
-    std::cout << "\n\t=> Adding edge distances... " << ctime(&rawtime);
+    out << "\n\t=> Adding edge distances... " << now();
     addEdgeDistances(pairToStats, jaccardToDist, params, g);
 
     if (!params.dist_tsv.empty()) {
-        time(&rawtime);
-        std::cout << "\n\t=> Writing distance estimates to TSV... "
-            << ctime(&rawtime);
-        writeDistTSV(params.dist_tsv, pairToStats, g);
+        out << "\n\t=> Writing distance estimates to TSV... "
+            << now();
+        writeDistTSV(params.dist_tsv, pairToStats, g, contigs);
+    }
+}
+
+/** The size of the scaffold graph of a set of parameters */
+struct ScaffoldCounts {
+    size_t pairs;
+    size_t vertices;
+    size_t edges;
+};
+
+/**
+ * Pair the contigs, and build and write the scaffold graph, using the
+ * parameters params. Write the progress to out. Several sets of
+ * parameters may be run concurrently.
+ */
+static ScaffoldCounts scaffold(const ARCS::ArcsParams& params,
+        const ARCS::IndexTable& itable, const ARCS::IndexMultMap& indexMultMap,
+        size_t numBarcodes, const ARCS::Contigs& contigs, const ARCS::ScaffSizeList& scaffSizeList,
+        std::ostream& out)
+{
+    size_t barcodeCount = countBarcodes(itable, indexMultMap, numBarcodes, params, out);
+
+    out << "\n=> Pairing scaffolds... " << now();
+    ARCS::PairMap pmap;
+    pairContigs(itable, params, pmap);
+
+    out << "\n=> Creating the graph... " << now();
+    ARCS::Graph g;
+    createGraph(pmap, params, g);
+
+    if (params.dist_est) {
+        out << "\n=> Calculating distance estimates... " << now();
+        calcDistanceEstimates(itable, contigs, params, g, out);
+    }
+
+    if (!params.base_name.empty()) {
+        out << "\n=> Writing graph file... " << now() << "\n";
+        std::string graphFile = params.base_name + "_original.gv";
+        writePostRemovalGraph(g, graphFile, contigs, params, out);
+    }
+    // Count the graph after -d has removed its vertices of high degree.
+    ScaffoldCounts counts = { pmap.size(), num_vertices(g), num_edges(g) };
+
+    if (!params.dist_graph_name.empty()) {
+        out << "\n=> Creating the ABySS graph... " << now();
+        DistGraph gdist;
+        createAbyssGraph(scaffSizeList, contigs, g, params, gdist);
+
+        out << "\n=> Writing the ABySS graph file... " << now() << "\n";
+        writeAbyssGraph(params.dist_graph_name, gdist);
+    }
+
+    if (!params.tsv_name.empty()) {
+        out << "\n=> Writing TSV file... " << now() << "\n";
+        writeTSV(params.tsv_name, itable, pmap, contigs, barcodeCount, params);
+    }
+    return counts;
+}
+
+/**
+ * Set the option key of --sweep, one of c, d, l, m and r, to value.
+ * @return false if the option or its value is invalid
+ */
+static bool setSweepOption(ARCS::ArcsParams& p, char key, const std::string& value)
+{
+    std::istringstream in(value);
+    char dash = '-';
+    switch (key) {
+        case 'c':
+            in >> p.min_reads; break;
+        case 'd':
+            in >> p.max_degree; break;
+        case 'l':
+            in >> p.min_links; break;
+        case 'm':
+            in >> p.min_mult >> dash >> p.max_mult; break;
+        case 'r':
+            in >> p.error_percent; break;
+        default:
+            return false;
+    }
+    return in && dash == '-' && in.peek() == EOF;
+}
+
+/**
+ * Parse an axis of --sweep, such as c=3,5,
+ * into its option and its values.
+ * @return false if the axis is invalid
+ */
+static bool parseSweepAxis(const std::string& axis, char& key,
+        std::vector<std::string>& values)
+{
+    if (axis.size() < 3 || axis[1] != '=')
+        return false;
+    key = axis[0];
+    values.clear();
+    std::istringstream in(axis.substr(2));
+    for (std::string value; std::getline(in, value, ',');) {
+        ARCS::ArcsParams p;
+        if (!setSweepOption(p, key, value))
+            return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+/**
+ * Insert suffix into the file name path, following the prefix base if
+ * path begins with it, and otherwise before the extension of its file
+ * name.
+ */
+static std::string addSuffix(const std::string& path, const std::string& suffix,
+        const std::string& base)
+{
+    size_t pos;
+    if (!base.empty() && path.compare(0, base.size(), base) == 0) {
+        pos = base.size();
+    } else {
+        size_t slash = path.rfind('/');
+        pos = path.find('.', slash == std::string::npos ? 0 : slash + 1);
+        if (pos == std::string::npos)
+            pos = path.size();
+    }
+    return path.substr(0, pos) + suffix + path.substr(pos);
+}
+
+/**
+ * Run each set of parameters of the grid of --sweep, sharing the
+ * IndexTable, in parallel. Each set writes its own output files,
+ * whose names have a suffix of its parameters, such as _c3_l5.
+ * Write a summary of the scaffold graph of each set.
+ */
+static void sweep(const ARCS::IndexTable& itable, const ARCS::IndexMultMap& indexMultMap,
+        size_t numBarcodes, const ARCS::Contigs& contigs, const ARCS::ScaffSizeList& scaffSizeList)
+{
+    // Expand the grid.
+    std::vector<ARCS::ArcsParams> sets(1, params);
+    std::vector<std::string> suffixes(1);
+    for (const auto& axis : params.sweep) {
+        char key;
+        std::vector<std::string> values;
+        bool ok = parseSweepAxis(axis, key, values);
+        assert(ok);
+        (void)ok;
+        std::vector<ARCS::ArcsParams> expandedSets;
+        std::vector<std::string> expandedSuffixes;
+        for (size_t i = 0; i < sets.size(); ++i) {
+            for (const auto& value : values) {
+                expandedSets.push_back(sets[i]);
+                setSweepOption(expandedSets.back(), key, value);
+                expandedSuffixes.push_back(suffixes[i] + '_' + key + value);
+            }
+        }
+        sets.swap(expandedSets);
+        suffixes.swap(expandedSuffixes);
+    }
+    for (size_t i = 0; i < sets.size(); ++i) {
+        ARCS::ArcsParams& p = sets[i];
+        for (std::string* name : { &p.base_name, &p.dist_graph_name, &p.tsv_name,
+                &p.dist_tsv, &p.dist_samples_tsv })
+            if (!name->empty())
+                *name = addSuffix(*name, suffixes[i], params.base_name);
+    }
+
+    std::cout << "\n=> Running " << sets.size() << " parameter sets... " << now();
+
+    // The ABySS graph names its vertices in a global dictionary.
+    // Name them before the sets are run concurrently.
+    if (!params.dist_graph_name.empty()) {
+        DistGraph gdist;
+        createAbyssGraph(scaffSizeList, contigs, ARCS::Graph(), params, gdist);
+    }
+
+    std::vector<ScaffoldCounts> counts(sets.size());
+    std::vector<std::string> logs(sets.size());
+#if _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(params.threads)
+#endif
+    for (size_t i = 0; i < sets.size(); ++i) {
+        std::ostringstream out;
+        counts[i] = scaffold(sets[i], itable, indexMultMap, numBarcodes,
+                contigs, scaffSizeList, out);
+        logs[i] = out.str();
+    }
+
+    for (size_t i = 0; i < sets.size(); ++i)
+        std::cout << "\n=> Parameter set " << suffixes[i].substr(1) << ":\n" << logs[i];
+
+    std::ostringstream summary;
+    summary << "Parameter_set\tc\td\tl\tm\tr\tPairs\tVertices\tEdges\n";
+    for (size_t i = 0; i < sets.size(); ++i) {
+        const ARCS::ArcsParams& p = sets[i];
+        summary << suffixes[i].substr(1)
+            << '\t' << p.min_reads
+            << '\t' << p.max_degree
+            << '\t' << p.min_links
+            << '\t' << p.min_mult << '-' << p.max_mult
+            << '\t' << p.error_percent
+            << '\t' << counts[i].pairs
+            << '\t' << counts[i].vertices
+            << '\t' << counts[i].edges
+            << '\n';
+    }
+    std::cout << "\n=> Parameter sweep summary:\n" << summary.str();
+    if (!params.base_name.empty()) {
+        const std::string path = params.base_name + "_sweep.tsv";
+        std::ofstream f(path.c_str());
+        assert_good(f, path);
+        f << summary.str();
+        assert_good(f, path);
+    }
+}
+
+/*
+ * Return the range of multiplicities of -m, or the union of the ranges
+ * of --sweep.
+ */
+static void getMultRange(int& minMult, int& maxMult)
+{
+    minMult = params.min_mult;
+    maxMult = params.max_mult;
+    for (const auto& axis : params.sweep) {
+        char key;
+        std::vector<std::string> values;
+        if (!parseSweepAxis(axis, key, values) || key != 'm')
+            continue;
+        for (const auto& value : values) {
+            ARCS::ArcsParams p;
+            setSweepOption(p, key, value);
+            minMult = std::min(minMult, p.min_mult);
+            maxMult = std::max(maxMult, p.max_mult);
+        }
     }
 }
 
@@ -911,7 +2715,16 @@ void runArcs(const std::vector<std::string>& filenames) {
         << "\n -l " << params.min_links
         << "\n -m " << params.min_mult << '-' << params.max_mult
         << "\n -r " << params.error_percent
+        << "\n --binomial=" << params.binomial
+        << "\n --significance-table=" << params.significance_table
         << "\n -s " << params.seq_id
+        << "\n -t " << params.threads
+        << "\n --max-memory=" << params.max_memory
+        << "\n --coordinate-sorted=" << params.coordinate_sorted
+        << "\n --two-pass=" << params.two_pass
+        << "\n --barcode-sketch=" << params.barcode_sketch
+        << "\n --barcode-sketch-size=" << params.barcode_sketch_size
+        << "\n --fast-exit=" << params.fast_exit
         << "\n -v " << params.verbose
         << "\n -z " << params.min_size
         << "\n --gap=" << params.gap
@@ -923,80 +2736,167 @@ void runArcs(const std::vector<std::string>& filenames) {
         // Input files
         << "\n -a " << maybeNA(params.fofName)
         << "\n -f " << maybeNA(params.file)
+        << "\n --save-evidence=" << maybeNA(params.save_evidence)
+        << "\n --load-evidence=" << maybeNA(params.load_evidence)
         << '\n';
+    for (const auto& axis : params.sweep)
+        std::cout << " --sweep=" << axis << '\n';
     for (const auto& filename : filenames)
         std::cout << ' ' << filename << '\n';
     std::cout.flush();
 
+    /*
+     * Free the nodes of the maps in one shot, once the maps, which
+     * are declared after this guard, are destroyed.
+     */
+    struct ReleasePools {
+        ~ReleasePools()
+        {
+            PoolArena<ARCS::IndexMapPool>::release();
+            PoolArena<>::release();
+        }
+    } releasePools;
+
     ARCS::IndexMap imap;
-    ARCS::PairMap pmap;
-    ARCS::Graph g;
 
     std::time_t rawtime;
 
     ARCS::ScaffSizeList scaffSizeList;
-    ARCS::ScaffSizeMap scaffSizeMap;
-    if (!params.file.empty()) {
+    ARCS::Contigs contigs;
+    ARCS::IndexMultMap indexMultMap;
+    /* The multiplicities counted by the first pass of --two-pass */
+    ARCS::IndexMultMap prefilterCounts;
+    ARCS::Evidence evidence;
+    if (!params.load_evidence.empty()) {
         time(&rawtime);
-        std::cout << "\n=> Getting scaffold sizes... " << ctime(&rawtime);
-        getScaffSizes(params.file, scaffSizeList);
-        scaffSizeMap.insert(scaffSizeList.begin(), scaffSizeList.end());
-    }
-
-    std::unordered_map<std::string, int> indexMultMap;
-    time(&rawtime);
-    std::cout << "\n=> Reading alignment files... " << ctime(&rawtime);
-    std::vector<std::string> bamFiles = readFof(params.fofName);
-    std::copy(filenames.begin(), filenames.end(), std::back_inserter(bamFiles));
-    readBAMS(bamFiles, imap, indexMultMap, scaffSizeList, scaffSizeMap);
+        std::cout << "\n=> Loading the evidence... " << ctime(&rawtime);
+        evidence.open(params.load_evidence);
+        evidence.load(contigs, scaffSizeList, barcodeCodec);
+    } else {
+        if (!params.file.empty()) {
+            time(&rawtime);
+            std::cout << "\n=> Getting scaffold sizes... " << ctime(&rawtime);
+            getScaffSizes(params.file, scaffSizeList);
+            for (const auto& it : scaffSizeList)
+                contigs.add(it.first, it.second);
+        }
 
-    size_t barcodeCount = countBarcodes(imap, indexMultMap);
+        std::vector<std::string> bamFiles = readFof(params.fofName);
+        std::copy(filenames.begin(), filenames.end(), std::back_inserter(bamFiles));
+        if (params.two_pass) {
+            getMultRange(prefilter.minMult, prefilter.maxMult);
+            if (areRegularFiles(bamFiles)) {
+                time(&rawtime);
+                std::cout << "\n=> Counting reads per barcode... " << ctime(&rawtime);
+                prefilter.pass = PASS_COUNT;
+                readBAMS(bamFiles, imap, indexMultMap, scaffSizeList, contigs);
+                // Keep the counts apart from the maps of the second pass,
+                // which --max-memory may spill and clear.
+                prefilterCounts.swap(indexMultMap);
+                prefilter.pass = PASS_FILTER;
+                prefilter.counts = &prefilterCounts;
+            } else {
+                prefilter.pass = PASS_TOMBSTONE;
+            }
+        }
 
-    if (!params.barcode_counts_name.empty()) {
         time(&rawtime);
-        std::cout << "\n=> Writing reads per barcode TSV file... " << ctime(&rawtime) << "\n";
-        writeBarcodeCountsTSV(params.barcode_counts_name, indexMultMap);
-    }
-
-    time(&rawtime);
-    std::cout << "\n=> Pairing scaffolds... " << ctime(&rawtime);
-    pairContigs(imap, pmap, indexMultMap);
-
-    time(&rawtime);
-    std::cout << "\n=> Creating the graph... " << ctime(&rawtime);
-    createGraph(pmap, g);
-
-    if (params.dist_est) {
-        std::cout << "\n=> Calculating distance estimates... " << ctime(&rawtime);
-        calcDistanceEstimates(imap, indexMultMap, scaffSizeMap, g);
+        std::cout << "\n=> Reading alignment files... " << ctime(&rawtime);
+        readBAMS(bamFiles, imap, indexMultMap, scaffSizeList, contigs);
+        if (prefilter.pass == PASS_FILTER) {
+            // The second pass does not count reads.
+            assert(indexMultMap.empty());
+            indexMultMap.swap(prefilterCounts);
+            prefilter.counts = NULL;
+        }
     }
 
-    if (!params.base_name.empty()) {
+    /*
+     * Number the contigs in the order of their names, so that ordering
+     * the contigs by ID orders them by name.
+     */
+    ARCS::IndexTable itable;
+    const std::vector<ARCS::ContigID> newIDs = contigs.sortByName();
+    if (barcodeSketch.enabled())
+        eraseUncountedBarcodes(imap, indexMultMap);
+    if (!params.save_evidence.empty()) {
         time(&rawtime);
-        std::cout << "\n=> Writing graph file... " << ctime(&rawtime) << "\n";
-        std::string graphFile = params.base_name + "_original.gv";
-        writePostRemovalGraph(g, graphFile);
+        std::cout << "\n=> Saving the evidence... " << ctime(&rawtime);
+        ARCS::Evidence::write(params.save_evidence, imap, indexMultMap,
+                newIDs, contigs, scaffSizeList, barcodeCodec);
+        ARCS::IndexMultMap().swap(indexMultMap);
+        evidence.open(params.save_evidence);
     }
-
-    if (!params.dist_graph_name.empty()) {
-        time(&rawtime);
-        std::cout << "\n=> Creating the ABySS graph... " << ctime(&rawtime);
-        DistGraph gdist;
-        createAbyssGraph(scaffSizeList, g, gdist);
-
+    size_t numBarcodes = 0;
+    bool merged = false;
+    if (!params.load_evidence.empty() || !params.save_evidence.empty()) {
+        evidence.buildTable(params.end_length, params.min_size, itable, indexMultMap);
+        numBarcodes = indexMultMap.size();
+    } else if (indexRuns.size() > 0) {
+        indexRuns.spill(imap, indexMultMap);
         time(&rawtime);
-        std::cout << "\n=> Writing the ABySS graph file... " << ctime(&rawtime) << "\n";
-        writeAbyssGraph(params.dist_graph_name, gdist);
+        std::cout << "\n=> Merging " << indexRuns.size()
+            << " sorted runs... " << ctime(&rawtime);
+        // Keep the multiplicities of the barcodes of -m only.
+        int minMult, maxMult;
+        getMultRange(minMult, maxMult);
+        numBarcodes = indexRuns.merge(newIDs, itable, indexMultMap,
+                minMult, maxMult, !params.barcode_counts_name.empty());
+        merged = true;
+    } else {
+        freezeIndexMap(imap, indexMultMap, newIDs, itable);
+        numBarcodes = indexMultMap.size();
     }
+    // The IndexMap is frozen or spilled. Free the memory of its pools.
+    ARCS::IndexMap().swap(imap);
+    PoolArena<ARCS::IndexMapPool>::release();
 
-    if (!params.tsv_name.empty()) {
+    if (!params.barcode_counts_name.empty()) {
         time(&rawtime);
-        std::cout << "\n=> Writing TSV file... " << ctime(&rawtime) << "\n";
-        writeTSV(params.tsv_name, imap, pmap, barcodeCount);
+        std::cout << "\n=> Writing reads per barcode TSV file... " << ctime(&rawtime) << "\n";
+        if (merged)
+            writeBarcodeCountsTSV(params.barcode_counts_name, indexRuns);
+        else
+            writeBarcodeCountsTSV(params.barcode_counts_name, indexMultMap);
     }
 
+    if (params.sweep.empty())
+        scaffold(params, itable, indexMultMap, numBarcodes, contigs, scaffSizeList, std::cout);
+    else
+        sweep(itable, indexMultMap, numBarcodes, contigs, scaffSizeList);
+
     time(&rawtime);
     std::cout << "\n=> Done. " << ctime(&rawtime);
+
+    if (params.fast_exit) {
+        // Exit without destroying the maps.
+        std::cout.flush();
+        std::cerr.flush();
+        _exit(EXIT_SUCCESS);
+    }
+}
+
+/*
+ * Parse a number of bytes, which may have a suffix K, M, G or T.
+ * Set the failbit of in if it is invalid.
+ */
+static size_t parseSize(std::istream& in)
+{
+    double size;
+    in >> size;
+    if (!in || size < 0)
+        return 0;
+    if (in.peek() != EOF) {
+        static const char units[] = "KMGT";
+        const char* unit = strchr(units, toupper(in.get()));
+        if (unit == NULL || *unit == '\0') {
+            in.setstate(std::ios::failbit);
+            return 0;
+        }
+        size *= double(1ull << 10 * (unit - units + 1));
+    }
+    in.peek();
+    return size_t(size);
 }
 
 int main(int argc, char** argv)
@@ -1013,6 +2913,34 @@ int main(int argc, char** argv)
                 arg >> params.file; break;
             case 'a':
                 arg >> params.fofName; break;
+            case 't':
+                arg >> params.threads; break;
+            case OPT_MAX_MEMORY:
+                params.max_memory = parseSize(arg); break;
+            case OPT_SAVE_EVIDENCE:
+                arg >> params.save_evidence; break;
+            case OPT_LOAD_EVIDENCE:
+                arg >> params.load_evidence; break;
+            case OPT_TWO_PASS:
+                params.two_pass = true; break;
+            case OPT_FAST_EXIT:
+                params.fast_exit = true; break;
+            case OPT_COORDINATE_SORTED:
+                params.coordinate_sorted = true; break;
+            case OPT_BARCODE_SKETCH:
+                arg >> params.barcode_sketch; break;
+            case OPT_BARCODE_SKETCH_SIZE:
+                params.barcode_sketch_size = parseSize(arg); break;
+            case OPT_SWEEP: {
+                std::string axis;
+                arg >> axis;
+                char key;
+                std::vector<std::string> values;
+                if (!parseSweepAxis(axis, key, values))
+                    arg.setstate(std::ios::failbit);
+                params.sweep.push_back(axis);
+                }
+                break;
             case 'B':
                 arg >> params.dist_bin_size; break;
             case 's':
@@ -1060,6 +2988,10 @@ int main(int argc, char** argv)
                 arg >> params.end_length; break;
             case 'r':
                 arg >> params.error_percent; break;
+            case OPT_BINOMIAL:
+                params.binomial = true; break;
+            case OPT_SIGNIFICANCE_TABLE:
+                arg >> params.significance_table; break;
             case 'v':
                 ++params.verbose; break;
             case OPT_HELP:
@@ -1101,11 +3033,49 @@ int main(int argc, char** argv)
     }
 
     std::vector<std::string> filenames(argv + optind, argv + argc);
-    if (params.fofName.empty() && filenames.empty()) {
+    if (!params.load_evidence.empty()) {
+        if (!params.fofName.empty() || !filenames.empty()) {
+            cerr << PROGRAM ": error: --load-evidence cannot be used with SAM/BAM files\n";
+            die = true;
+        }
+    } else if (params.fofName.empty() && filenames.empty()) {
         cerr << PROGRAM ": error: specify input SAM/BAM file(s) or a list of files with -a option\n";
         die = true;
     }
 
+    if ((!params.save_evidence.empty() || !params.load_evidence.empty())
+            && params.end_length % ARCS::Evidence::BIN_SIZE != 0) {
+        cerr << PROGRAM ": error: -e must be a multiple of "
+            << ARCS::Evidence::BIN_SIZE << " with --save-evidence or --load-evidence\n";
+        die = true;
+    }
+
+    if (!params.save_evidence.empty() && params.max_memory > 0) {
+        cerr << PROGRAM ": error: --save-evidence cannot be used with --max-memory\n";
+        die = true;
+    }
+
+    if (!params.save_evidence.empty() && params.two_pass) {
+        cerr << PROGRAM ": error: --save-evidence cannot be used with --two-pass\n";
+        die = true;
+    }
+
+    if (params.barcode_sketch > 0) {
+        int minMult, maxMult;
+        getMultRange(minMult, maxMult);
+        if (params.barcode_sketch > CountMinSketch::MAX_LIMIT
+                || int(params.barcode_sketch) > minMult) {
+            cerr << PROGRAM ": error: --barcode-sketch must be at most "
+                << CountMinSketch::MAX_LIMIT << " and the minimum of -m\n";
+            die = true;
+        }
+        if (params.barcode_sketch_size < CountMinSketch::DEPTH) {
+            cerr << PROGRAM ": error: --barcode-sketch-size must be at least "
+                << CountMinSketch::DEPTH << '\n';
+            die = true;
+        }
+    }
+
     if (die) {
         std::cerr << "Try " PROGRAM " --help for more information.\n";
         exit(EXIT_FAILURE);
@@ -1115,9 +3085,14 @@ int main(int argc, char** argv)
         assert_readable(params.file);
     if (!params.fofName.empty())
       assert_readable(params.fofName);
+    if (!params.load_evidence.empty())
+      assert_readable(params.load_evidence);
     for (const auto& filename : filenames)
       assert_readable(filename);
 
+    indexRuns.setLimit(params.max_memory / std::max(1u, params.threads));
+    if (params.barcode_sketch > 0 && params.load_evidence.empty())
+        barcodeSketch.init(params.barcode_sketch_size, params.barcode_sketch);
     runArcs(filenames);
 
     return 0;
@@ -3,13 +3,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <getopt.h>
 #include <string>
 #include <iostream>
 #include <utility>
 #include <algorithm>
+#include <array>
+#include <cassert>
 #include <cmath>
 #include <map>
+#include <mutex>
 #include <unordered_map>
 #include <fstream>
 #include <sstream>
@@ -19,9 +23,12 @@
 #include <time.h>
 #include <boost/graph/undirected_graph.hpp>
 #include <boost/graph/graphviz.hpp>
+#include "Common/Barcode.h"
+#include "Common/PoolAllocator.h"
 #include "Common/Uncompress.h"
 #include "DataLayer/FastaReader.h"
 #include "DataLayer/FastaReader.cpp"
+#include "Common/Dictionary.h"
 
 
 namespace ARCS {
@@ -37,6 +44,26 @@ namespace ARCS {
         bool bx;
         std::string file;
         std::string fofName;
+        /** number of threads */
+        unsigned threads;
+        /** memory limit in bytes of the maps of the alignments, or 0 */
+        size_t max_memory;
+        /** the alignments are sorted by coordinate rather than grouped by read name */
+        bool coordinate_sorted;
+        /** read the alignments twice to prefilter the barcodes by multiplicity */
+        bool two_pass;
+        /** exit without freeing the memory of the maps */
+        bool fast_exit;
+        /** the number of reads of a barcode counted by a sketch, or 0 */
+        unsigned barcode_sketch;
+        /** the size in bytes of the sketch */
+        size_t barcode_sketch_size;
+        /** output path for the evidence of the alignments */
+        std::string save_evidence;
+        /** input path for the evidence of the alignments */
+        std::string load_evidence;
+        /** the axes of the parameter sweep, such as c=3,5 */
+        std::vector<std::string> sweep;
         int seq_id;
         int min_reads;
         /** enable/disable distance estimation on graph edges */
@@ -61,10 +88,21 @@ namespace ARCS {
         int max_degree;
         int end_length;
         float error_percent;
+        /** use the exact binomial test for error_percent */
+        bool binomial;
+        /** the largest number of read pairs or links of the tabulated tests */
+        unsigned significance_table;
         int verbose;
 
         ArcsParams() :
             bx(false),
+            threads(1),
+            max_memory(0),
+            coordinate_sorted(false),
+            two_pass(false),
+            fast_exit(false),
+            barcode_sketch(0),
+            barcode_sketch_size(64 << 20),
             seq_id(98),
             min_reads(5),
             dist_est(false),
@@ -78,24 +116,110 @@ namespace ARCS {
             max_degree(0),
             end_length(30000),
             error_percent(0.05),
+            binomial(false),
+            significance_table(16384),
             verbose(0) {
         }
 
     };
 
-    /* ScafMap: <pair(scaffold id, bool), count>, cout =  # times index maps to scaffold (c), bool = true-head, false-tail*/
-    typedef std::map<std::pair<std::string, bool>, int> ScafMap;
+    /** a contig ID, an index into the dictionary of contig names */
+    typedef Dictionary::index_type ContigID;
+
+    /* The tag of the node pools of the IndexMap, which are released once it is frozen */
+    struct IndexMapPool { };
+
+    /* ScafMap: <pair(scaffold id, end), count>, cout =  # times index maps to scaffold (c), end = 1-head, 0-tail,
+     * or with --save-evidence, the end of Evidence::end */
+    typedef std::map<std::pair<ContigID, unsigned>, int,
+            std::less<std::pair<ContigID, unsigned>>,
+            PoolAllocator<std::pair<const std::pair<ContigID, unsigned>, int>,
+                IndexMapPool>> ScafMap;
     typedef typename ScafMap::const_iterator ScafMapConstIt;
-    /* IndexMap: key = index sequence, value = ScafMap */
-    typedef std::unordered_map<std::string, ScafMap> IndexMap;
-    /* PairMap: key = pair(first < second) of scaf sequence id, value = num links*/
-    typedef std::map<std::pair<std::string, std::string>, std::vector<unsigned>> PairMap;
+    /* IndexMap: key = packed index sequence, value = ScafMap */
+    typedef std::unordered_map<BarcodeID, ScafMap, std::hash<BarcodeID>,
+            std::equal_to<BarcodeID>,
+            PoolAllocator<std::pair<const BarcodeID, ScafMap>, IndexMapPool>> IndexMap;
+    /* IndexMultMap: key = packed index sequence, value = number of reads */
+    typedef std::unordered_map<BarcodeID, int, std::hash<BarcodeID>,
+            std::equal_to<BarcodeID>, PoolAllocator<std::pair<const BarcodeID, int>>> IndexMultMap;
+    /* The numbers of read pairs of a barcode that align to the head and tail of a contig */
+    struct ContigEndCounts {
+        ContigID contig;
+        int head;
+        int tail;
+    };
+
+    /**
+     * IndexTable: the IndexMap frozen in compressed sparse row format
+     * once all the alignments have been read. The barcodes are sorted
+     * by ID, and the contigs of each barcode are sorted by ID. Every
+     * contig of a barcode has the counts of both of its ends.
+     */
+    struct IndexTable {
+        /* The barcodes, sorted */
+        std::vector<BarcodeID> barcodes;
+        /* The multiplicity of each barcode */
+        std::vector<int> multiplicities;
+        /* The contigs of barcode i are contigs[offsets[i]] to contigs[offsets[i + 1]] */
+        std::vector<size_t> offsets;
+        std::vector<ContigEndCounts> contigs;
 
-    /** A contig end: (FASTA ID, head?) */
-    typedef std::pair<std::string, bool> CI;
+        /* Return the number of barcodes. */
+        size_t size() const { return barcodes.size(); }
+
+        /* Return the contigs of the barcode i. */
+        const ContigEndCounts* begin(size_t i) const { return contigs.data() + offsets[i]; }
+        const ContigEndCounts* end(size_t i) const { return contigs.data() + offsets[i + 1]; }
+    };
+
+    /** A contig end: (contig ID, head?) */
+    typedef std::pair<ContigID, bool> CI;
 
     /** a pair of contig IDs */
-    typedef std::pair<std::string, std::string> ContigPair;
+    typedef std::pair<ContigID, ContigID> ContigPair;
+
+    /**
+     * PairMap: key = pair(first < second) of scaf sequence id, value =
+     * num links of each orientation: Head-Head, Head-Tail, Tail-Head
+     * and Tail-Tail.
+     * The pairs sorted by their two contig IDs, which are packed into
+     * 64 bits, with the counts stored inline. SharedBarcodes counts the
+     * links of every pair and assigns them in order.
+     */
+    class PairMap
+    {
+      public:
+        typedef std::array<uint32_t, 4> Counts;
+
+        struct Entry {
+            uint64_t key;
+            Counts counts;
+
+            /** Return the pair of contigs. */
+            ContigPair pair() const { return ContigPair(key >> 32, uint32_t(key)); }
+        };
+
+        typedef const Entry* const_iterator;
+
+        /** Return the number of pairs. */
+        size_t size() const { return m_entries.size(); }
+
+        /** Replace the pairs by pairs sorted by contig IDs. */
+        void assign(std::vector<Entry>& sorted)
+        {
+            assert(std::is_sorted(sorted.begin(), sorted.end(),
+                        [](const Entry& a, const Entry& b) { return a.key < b.key; }));
+            m_entries.swap(sorted);
+        }
+
+        /** Iterate over the pairs in order. */
+        const_iterator begin() const { return m_entries.data(); }
+        const_iterator end() const { return m_entries.data() + m_entries.size(); }
+
+      private:
+        std::vector<Entry> m_entries;
+    };
 
     /**
      * a list of the input scaffolds and their lengths, in the order
@@ -103,18 +227,138 @@ namespace ARCS {
      */
     typedef std::vector< std::pair<std::string, int> > ScaffSizeList;
 
+    /** maps contig ID to contig length (bp) */
+    typedef std::vector<int> ContigToLength;
+
     /**
-     * a list of the input scaffolds and their lengths, in the order
-     * that they appear in the input contigs FASTA file
+     * The names and lengths of the contigs. The names are interned as
+     * dense contig IDs, so that the maps of the alignments are keyed
+     * on integers rather than strings.
+     * Contigs that are aligned to but missing from the SAM/BAM header
+     * are numbered after the other contigs. Several threads may find
+     * and add them concurrently.
      */
-    typedef std::unordered_map<std::string, int> ScaffSizeMap;
+    class Contigs
+    {
+      public:
+        Contigs() { }
+
+        /** Return whether there are no contigs. */
+        bool empty() const { return m_names.empty() && m_unknown.empty(); }
+
+        /** Return the number of contigs. */
+        size_t size() const { return m_names.size(); }
 
-    /** maps contig FASTA ID to contig length (bp) */
-    typedef std::unordered_map<std::string, int> ContigToLength;
-    typedef typename ContigToLength::const_iterator ContigToLengthIt;
+        /** Return the name of the specified contig. */
+        Dictionary::name_reference name(ContigID id) const
+        {
+            return m_names.getName(id);
+        }
+
+        /** Return the lengths of the contigs, indexed by ID. */
+        const ContigToLength& lengths() const { return m_lengths; }
+
+        /** Reserve memory for n contigs. */
+        void reserve(size_t n)
+        {
+            m_names.reserve(n);
+            m_lengths.reserve(n);
+        }
+
+        /** Add a contig, unless a contig of that name exists already. */
+        void add(const std::string& name, int length)
+        {
+            addUnknown();
+            if (m_names.count(name) == 0) {
+                m_names.insert(name);
+                m_lengths.push_back(length);
+            }
+        }
+
+        /**
+         * Find the specified contig.
+         * @return false if the contig is not found
+         */
+        bool find(const std::string& name, ContigID& id) const
+        {
+            return m_names.find(name, id);
+        }
+
+        /**
+         * Return the ID of the specified contig, and store its length
+         * in length. Add the contig with a length of zero if it is not
+         * found. This function may be called concurrently by several
+         * threads, but not concurrently with add.
+         */
+        ContigID findOrAddUnknown(const std::string& name, int& length)
+        {
+            ContigID id;
+            if (m_names.find(name, id)) {
+                length = m_lengths[id];
+                return id;
+            }
+            length = 0;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_unknown.find(name, id))
+                id = m_unknown.insert(name);
+            return m_names.size() + id;
+        }
+
+        /** Add the contigs found by findOrAddUnknown. */
+        void addUnknown()
+        {
+            for (size_t i = 0; i < m_unknown.size(); ++i) {
+                m_names.insert(std::string(m_unknown.getName(i)));
+                m_lengths.push_back(0);
+            }
+            m_unknown.clear();
+        }
+
+        /**
+         * Renumber the contigs in the order of their names.
+         * @return the new ID of each contig, indexed by its old ID
+         */
+        std::vector<ContigID> sortByName()
+        {
+            addUnknown();
+            std::vector<ContigID> order(m_names.size());
+            for (ContigID i = 0; i < order.size(); ++i)
+                order[i] = i;
+            std::sort(order.begin(), order.end(),
+                [this](ContigID a, ContigID b) {
+                    return strcmp(m_names.getName(a), m_names.getName(b)) < 0;
+                });
+
+            std::vector<std::string> names;
+            ContigToLength lengths;
+            names.reserve(order.size());
+            lengths.reserve(order.size());
+            std::vector<ContigID> newIDs(order.size());
+            for (ContigID i = 0; i < order.size(); ++i) {
+                names.push_back(std::string(m_names.getName(order[i])));
+                lengths.push_back(m_lengths[order[i]]);
+                newIDs[order[i]] = i;
+            }
+            m_names.clear();
+            for (const auto& name : names)
+                m_names.insert(name);
+            m_lengths.swap(lengths);
+            return newIDs;
+        }
+
+      private:
+        Contigs(const Contigs&);
+        Contigs& operator=(const Contigs&);
+
+        Dictionary m_names;
+        ContigToLength m_lengths;
+        /* The contigs that are missing from the header */
+        Dictionary m_unknown;
+        std::mutex m_mutex;
+    };
 
     struct VertexProperties {
-        std::string id;
+        ContigID id;
     };
 
     /* Orientation: 0-HH, 1-HT, 2-TH, 3-TT */
@@ -170,16 +414,18 @@ namespace ARCS {
         typedef typename boost::vertex_property<GraphT>::type VP;
 
         GraphT& m_g;
+        const Contigs& m_contigs;
 
-        VertexPropertyWriter(GraphT& g) : m_g(g) {}
+        VertexPropertyWriter(GraphT& g, const Contigs& contigs)
+            : m_g(g), m_contigs(contigs) {}
         void operator()(std::ostream& out, const V& v) const
         {
-            out << " [id=" << m_g[v].id << "]";
+            out << " [id=" << m_contigs.name(m_g[v].id) << "]";
         }
     };
 
 	typedef boost::undirected_graph<VertexProperties, EdgeProperties> Graph;
-    typedef std::unordered_map<std::string, Graph::vertex_descriptor> VidVdesMap;
+    typedef std::unordered_map<ContigID, Graph::vertex_descriptor> VidVdesMap;
     typedef boost::graph_traits<ARCS::Graph>::vertex_descriptor VertexDes;
 }
 
@@ -2,15 +2,19 @@
 #define _DISTANCE_EST_H_ 1
 
 #include "Arcs/Arcs.h"
+#include "Arcs/SharedBarcodes.h"
 #include "Common/MapUtil.h"
-#include "Common/PairHash.h"
 #include "Common/StatUtil.h"
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstdlib>
 #include <limits>
 #include <iostream>
+#include <stdint.h>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 /** min/max distance estimate for a pair contigs */
 struct DistanceEstimate
@@ -46,7 +50,7 @@ struct DistSample
 };
 
 /** maps contig ID => intra-contig distance/barcode sample */
-typedef std::unordered_map<std::string, DistSample> DistSampleMap;
+typedef std::unordered_map<ARCS::ContigID, DistSample> DistSampleMap;
 typedef typename DistSampleMap::const_iterator DistSampleConstIt;
 
 /** maps barcode Jaccard index => intra-contig distance sample */
@@ -79,77 +83,73 @@ typedef typename PairToBarcodeStats::iterator PairToBarcodeStatsIt;
  * Measure distance between contig ends vs.
  * barcode intersection size and barcode union size.
  */
-void calcDistSamples(const ARCS::IndexMap& imap,
+void calcDistSamples(const ARCS::IndexTable& itable,
 	const ARCS::ContigToLength& contigToLength,
-	const std::unordered_map<std::string, int>& indexMultMap,
 	const ARCS::ArcsParams& params,
 	DistSampleMap& distSamples)
 {
 	/* for each chromium barcode */
-	for (auto barcodeIt = imap.begin(); barcodeIt != imap.end();
-		++barcodeIt)
+	for (size_t i = 0; i < itable.size(); ++i)
 	{
 		/* skip barcodes outside of min/max multiplicity range */
-		std::string index = barcodeIt->first;
-		int indexMult = indexMultMap.at(index);
+		int indexMult = itable.multiplicities[i];
 		if (indexMult < params.min_mult || indexMult > params.max_mult)
 			continue;
 
-		/* contig head/tail => number of mapped read pairs */
-		const ARCS::ScafMap& contigToCount = barcodeIt->second;
-
-		for (auto contigIt = contigToCount.begin();
-			contigIt != contigToCount.end(); ++contigIt)
+		/* contig => number of read pairs mapped to head/tail */
+		for (const ARCS::ContigEndCounts* contigIt = itable.begin(i);
+			contigIt != itable.end(i); ++contigIt)
 		{
-			std::string contigID;
-			bool isHead;
-			std::tie(contigID, isHead) = contigIt->first;
-			int readPairs = contigIt->second;
-
-			/*
-			 * skip contigs with less than required number of
-			 * mapped read pairs (-c option)
-			 */
-			if (readPairs < params.min_reads)
-				continue;
+			ARCS::ContigID contigID = contigIt->contig;
 
-			/*
-			 * skip contigs shorter than 2 times the contig
-			 * end length, because we want our distance samples
-			 * to be based on a uniform head/tail length
-			 */
+			for (int end = 0; end < 2; ++end)
+			{
+				bool isHead = end == 1;
+				int readPairs = isHead ? contigIt->head : contigIt->tail;
+
+				/*
+				 * skip contigs with less than required number of
+				 * mapped read pairs (-c option)
+				 */
+				if (readPairs < params.min_reads)
+					continue;
 
-			unsigned l = contigToLength.at(contigID);
-			if (l < (unsigned) 2 * params.end_length)
-				continue;
+				/*
+				 * skip contigs shorter than 2 times the contig
+				 * end length, because we want our distance samples
+				 * to be based on a uniform head/tail length
+				 */
 
-			DistSample& distSample = distSamples[contigID];
-			distSample.distance = l - 2 * params.end_length;
-
-			if (isHead)
-				distSample.barcodesHead++;
-			else
-				distSample.barcodesTail++;
-
-			/*
-			 * Check if barcode also maps to other end of contig
-			 * with sufficient number of read pairs.
-			 *
-			 * The `isHead` part of the `if` condition prevents
-			 * double-counting when a barcode maps to both
-			 * ends of a contig.
-			 */
-
-			ARCS::CI otherEnd(contigID, !isHead);
-			ARCS::ScafMapConstIt otherIt = contigToCount.find(otherEnd);
-			bool foundOther = otherIt != contigToCount.end()
-				&& otherIt->second >= params.min_reads;
-
-			if (foundOther && isHead) {
-				distSample.barcodesIntersect++;
-				distSample.barcodesUnion++;
-			} else if (!foundOther) {
-				distSample.barcodesUnion++;
+				unsigned l = contigToLength.at(contigID);
+				if (l < (unsigned) 2 * params.end_length)
+					continue;
+
+				DistSample& distSample = distSamples[contigID];
+				distSample.distance = l - 2 * params.end_length;
+
+				if (isHead)
+					distSample.barcodesHead++;
+				else
+					distSample.barcodesTail++;
+
+				/*
+				 * Check if barcode also maps to other end of contig
+				 * with sufficient number of read pairs.
+				 *
+				 * The `isHead` part of the `if` condition prevents
+				 * double-counting when a barcode maps to both
+				 * ends of a contig.
+				 */
+
+				int otherPairs = isHead ? contigIt->tail : contigIt->head;
+				bool foundOther = otherPairs >= params.min_reads;
+
+				if (foundOther && isHead) {
+					distSample.barcodesIntersect++;
+					distSample.barcodesUnion++;
+				} else if (!foundOther) {
+					distSample.barcodesUnion++;
+				}
 			}
 		}
 	}
@@ -160,14 +160,26 @@ void calcDistSamples(const ARCS::IndexMap& imap,
  * distance sample. Each distance sample comes from
  * measuring the distance between the head/tail of the
  * same contig, along with associated head/tail barcode
- * counts.
+ * counts. When several samples have the same Jaccard index,
+ * keep the sample of the first contig by ID, which is the order
+ * of their names, so that the result does not depend on the
+ * order of the hash table.
  */
 static inline void buildJaccardToDist(
 	const DistSampleMap& distSamples,
 	JaccardToDist& jaccardToDist)
 {
+	std::vector<DistSampleConstIt> sorted;
+	sorted.reserve(distSamples.size());
 	for (DistSampleConstIt it = distSamples.begin();
 		it != distSamples.end(); ++it)
+		sorted.push_back(it);
+	std::sort(sorted.begin(), sorted.end(),
+		[](const DistSampleConstIt& a, const DistSampleConstIt& b) {
+			return a->first < b->first;
+		});
+
+	for (const auto& it : sorted)
 	{
 		const DistSample& sample = it->second;
 		double jaccard = double(sample.barcodesIntersect)
@@ -205,88 +217,42 @@ static inline bool validBarcodeMapping(unsigned contigLength,
 	return true;
 }
 
-/** calculate shared barcode stats for candidate contig pairs */
+/**
+ * calculate shared barcode stats for candidate contig pairs,
+ * which are the edges of the graph
+ */
 static inline void buildPairToBarcodeStats(
-	const ARCS::IndexMap& imap,
-	const std::unordered_map<std::string, int>& indexMultMap,
+	const ARCS::IndexTable& itable,
 	const ARCS::ContigToLength& contigToLength,
 	const ARCS::ArcsParams& params,
+	const ARCS::Graph& g,
 	PairToBarcodeStats& pairToStats)
 {
-	typedef std::unordered_map<ARCS::CI, size_t, PairHash> ContigEndToBarcodeCount;
-	typedef typename ContigEndToBarcodeCount::const_iterator BarcodeCountConstIt;
-	ContigEndToBarcodeCount contigEndToBarcodeCount;
-
-	/* calculate number of shared barcodes for candidate contig end pairs */
-
-	for (auto barcodeIt = imap.begin(); barcodeIt != imap.end();
-		++barcodeIt)
-	{
-		/* skip barcodes outside of min/max multiplicity range */
-		std::string index = barcodeIt->first;
-		int indexMult = indexMultMap.at(index);
-		if (indexMult < params.min_mult || indexMult > params.max_mult)
-			continue;
-
-		/* contig head/tail => number of mapped read pairs */
-		const ARCS::ScafMap& contigEndToPairCount = barcodeIt->second;
-
-		for (auto endIt1 = contigEndToPairCount.begin();
-			endIt1 != contigEndToPairCount.end(); ++endIt1)
-		{
-			/* get contig ID and head/tail flag */
-			std::string id1;
-			bool head1;
-			std::tie(id1, head1) = endIt1->first;
-
-			/* check requirements for calculating distance estimates */
-			unsigned length1 = contigToLength.at(id1);
-			int pairs1 = endIt1->second;
-			if (!validBarcodeMapping(length1, pairs1, params))
-				continue;
-
-			/* count distinct barcodes mapped to head/tail of each contig */
-			contigEndToBarcodeCount[endIt1->first]++;
-
-			for (auto endIt2 = contigEndToPairCount.begin();
-				 endIt2 != contigEndToPairCount.end(); ++endIt2)
-			{
-				/* get contig ID and head/tail flag */
-				std::string id2;
-				bool head2;
-				std::tie(id2, head2) = endIt2->first;
-
-				/* check requirements for calculating distance estimates */
-				unsigned length2 = contigToLength.at(endIt2->first.first);
-				int pairs2 = endIt2->second;
-				if (!validBarcodeMapping(length2, pairs2, params))
-					continue;
-
-				/* avoid double-counting contig end pairs */
-				if (id1 > id2)
-					continue;
-
-				/* initialize barcode/weight data for contig end pair */
-				ARCS::ContigPair pair(id1, id2);
-				if (pairToStats.count(pair) == 0)
-					pairToStats[pair].fill(BarcodeStats());
-
-				// Head - Head
-				if (head1 && head2) {
-					pairToStats[pair][0].barcodesIntersect++;
-				// Head - Tail
-				} else if (head1 && !head2) {
-					pairToStats[pair][1].barcodesIntersect++;
-				// Tail - Head
-				} else if (!head1 && head2) {
-					pairToStats[pair][2].barcodesIntersect++;
-				// Tail - Tail
-				} else if (!head1 && !head2) {
-					pairToStats[pair][3].barcodesIntersect++;
-				}
-			}
-		}
+	/* the contig ends that meet the requirements of each barcode */
+	ARCS::SharedBarcodes shared(itable, params,
+		[&](const ARCS::ContigEndCounts& counts) {
+			unsigned length = contigToLength.at(counts.contig);
+			unsigned ends = 0;
+			if (validBarcodeMapping(length, counts.head, params))
+				ends |= ARCS::SharedBarcodes::HEAD;
+			if (validBarcodeMapping(length, counts.tail, params))
+				ends |= ARCS::SharedBarcodes::TAIL;
+			return ends;
+		});
+
+	/* calculate number of shared barcodes for the edges only */
+	std::unordered_set<uint64_t> edges;
+	for (const auto e : boost::make_iterator_range(boost::edges(g))) {
+		ARCS::ContigID id1 = g[source(e, g)].id;
+		ARCS::ContigID id2 = g[target(e, g)].id;
+		edges.insert(uint64_t(id1) << 32 | id2);
 	}
+	std::vector<ARCS::PairMap::Entry> pairs;
+	shared.multiply(ARCS::SharedBarcodes::threads(params),
+		[&edges](ARCS::ContigID id1, ARCS::ContigID id2,
+				const ARCS::PairMap::Counts&) {
+			return edges.count(uint64_t(id1) << 32 | id2) > 0;
+		}, pairs);
 
 	/*
 	 * Compute/store further barcode stats for each candidate
@@ -297,30 +263,26 @@ static inline void buildPairToBarcodeStats(
 	 * (3) barcode union size for contigs A and B (|A union B|)
 	 */
 
-	for (PairToBarcodeStatsIt it = pairToStats.begin(); it != pairToStats.end(); ++it)
+	for (const ARCS::PairMap::Entry& pair : pairs)
 	{
+		ARCS::ContigID id1, id2;
+		std::tie(id1, id2) = pair.pair();
+		BarcodeStatsArray& statsArray = pairToStats.insert(pairToStats.end(),
+			std::make_pair(pair.pair(), BarcodeStatsArray()))->second;
+
 		for (PairOrientation i = HH; i < NUM_ORIENTATIONS;
 			i = PairOrientation(i + 1))
 		{
-			BarcodeStats& stats = it->second.at(i);
-
-			const std::string& id1 = it->first.first;
-			const std::string& id2 = it->first.second;
-
-			ARCS::CI tail1(id1, i == HH || i == HT);
-			ARCS::CI tail2(id2, i == HH || i == TH);
+			BarcodeStats& stats = statsArray.at(i);
+			stats.barcodesIntersect = pair.counts[i];
 
-			BarcodeCountConstIt countIt1 = contigEndToBarcodeCount.find(tail1);
-			if (countIt1 == contigEndToBarcodeCount.end())
+			stats.barcodes1 = shared.barcodes(id1, i == HH || i == HT);
+			if (stats.barcodes1 == 0)
 				continue;
-			stats.barcodes1 = countIt1->second;
-			assert(stats.barcodes1 > 0);
 
-			BarcodeCountConstIt countIt2 = contigEndToBarcodeCount.find(tail2);
-			if (countIt2 == contigEndToBarcodeCount.end())
+			stats.barcodes2 = shared.barcodes(id2, i == HH || i == TH);
+			if (stats.barcodes2 == 0)
 				continue;
-			stats.barcodes2 = countIt2->second;
-			assert(stats.barcodes2 > 0);
 
 			assert(stats.barcodes1 + stats.barcodes2 >= stats.barcodesIntersect);
 			stats.barcodesUnion = stats.barcodes1 + stats.barcodes2
@@ -432,7 +394,8 @@ static inline void addEdgeDistances(
 
 /** dump distance estimates and barcode data to TSV */
 static inline void writeDistTSV(const std::string& path,
-	const PairToBarcodeStats& pairToStats, const ARCS::Graph& g)
+	const PairToBarcodeStats& pairToStats, const ARCS::Graph& g,
+	const ARCS::Contigs& contigs)
 {
 	assert(!path.empty());
 
@@ -473,8 +436,8 @@ static inline void writeDistTSV(const std::string& path,
 		bool sense1 = orientation < 2;
 		bool sense2 = orientation % 2;
 
-		tsvOut << pair.first << (sense1 ? '-' : '+') << '\t'
-			<< pair.second << (sense2 ? '-' : '+') << '\t';
+		tsvOut << contigs.name(pair.first) << (sense1 ? '-' : '+') << '\t'
+			<< contigs.name(pair.second) << (sense2 ? '-' : '+') << '\t';
 		if (g[e].jaccard >= 0) {
 			tsvOut << g[e].minDist << '\t'
 				<< g[e].dist << '\t'
@@ -489,8 +452,8 @@ static inline void writeDistTSV(const std::string& path,
 			<< stats.barcodesUnion << '\t'
 			<< stats.barcodesIntersect << '\n';
 
-		tsvOut << pair.second << (sense2 ? '+' : '-') << '\t'
-			<< pair.first << (sense1 ? '+' : '-') << '\t';
+		tsvOut << contigs.name(pair.second) << (sense2 ? '+' : '-') << '\t'
+			<< contigs.name(pair.first) << (sense1 ? '+' : '-') << '\t';
 		if (g[e].jaccard >= 0) {
 			tsvOut << g[e].minDist << '\t'
 				<< g[e].dist << '\t'
@@ -518,7 +481,7 @@ static inline void writeDistTSV(const std::string& path,
  * barcode intersection size).
  */
 static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
-	const DistSampleMap& distSamples)
+	const DistSampleMap& distSamples, const ARCS::Contigs& contigs)
 {
 	out << "contig_id" << '\t'
 		<< "distance" << '\t'
@@ -530,10 +493,10 @@ static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
 	for (DistSampleConstIt it = distSamples.begin();
 		it != distSamples.end(); ++it)
 	{
-		const std::string& contigID = it->first;
+		ARCS::ContigID contigID = it->first;
 		const DistSample& sample = it->second;
 
-		out << contigID << '\t'
+		out << contigs.name(contigID) << '\t'
 			<< sample.distance << '\t'
 			<< sample.barcodesHead << '\t'
 			<< sample.barcodesTail << '\t'
@@ -549,7 +512,7 @@ static inline std::ostream& writeDistSamplesTSV(std::ostream& out,
  * TSV file.
  */
 static inline void writeDistSamplesTSV(const std::string& path,
-	const DistSampleMap& distSamples)
+	const DistSampleMap& distSamples, const ARCS::Contigs& contigs)
 {
 	if (path.empty())
 		return;
@@ -557,7 +520,7 @@ static inline void writeDistSamplesTSV(const std::string& path,
 	ofstream samplesOut;
 	samplesOut.open(path.c_str());
 	assert(samplesOut);
-	writeDistSamplesTSV(samplesOut, distSamples);
+	writeDistSamplesTSV(samplesOut, distSamples, contigs);
 	assert(samplesOut);
 	samplesOut.close();
 }
@@ -0,0 +1,405 @@
+#ifndef ARCS_EVIDENCE_H
+#define ARCS_EVIDENCE_H 1
+
+#include "Arcs/Arcs.h"
+#include "Common/Barcode.h"
+#include "Common/MappedFile.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ARCS {
+
+    /**
+     * A checkpoint of the evidence of the alignments, so that ARCS may
+     * be run again with different parameters without reading the
+     * alignments. It holds the multiplicity of each barcode, the
+     * contigs and their lengths, and the number of read pairs of each
+     * barcode that align to each contig, by end of the contig and by
+     * distance from that end in bins of BIN_SIZE bp. Any -z and any
+     * -e that is a multiple of BIN_SIZE may be used when loading it.
+     *
+     * The file is a header followed by arrays, each aligned to eight
+     * bytes, in the byte order of the machine, so that it may be
+     * mapped into memory and used without parsing:
+     * - the lengths of the contigs: int32[numContigs]
+     * - the names of the contigs: uint64 offsets[numContigs + 1],
+     *   char names[namesSize]
+     * - the input scaffolds in the order of the input:
+     *   (uint32 contig, int32 length)[numScaffolds]
+     * - the barcodes that are not packed into their IDs, in the order
+     *   of their IDs: uint64 offsets[numFallbackBarcodes + 1],
+     *   char names[fallbackSize]
+     * - the barcode IDs, sorted: uint64[numBarcodes]
+     * - the multiplicity of each barcode: int32[numBarcodes]
+     * - the entries of barcode i are entries[offsets[i]] to
+     *   entries[offsets[i + 1]]: uint64 offsets[numBarcodes + 1]
+     * - (uint32 contig, uint32 end, int32 count)[numEntries], sorted by
+     *   contig and end within each barcode
+     */
+    class Evidence
+    {
+      public:
+        static const uint32_t FORMAT_VERSION = 1;
+        static const unsigned BIN_SIZE = 100;
+
+        /* The number of read pairs of a barcode at an end of a contig */
+        struct Entry {
+            ContigID contig;
+            /* 2 * bin + 1 for the head, or 2 * bin for the tail */
+            uint32_t end;
+            int32_t count;
+        };
+
+        /**
+         * Return the end of a read pair at position pos of a contig of
+         * length size: the end nearer to pos, and the distance from
+         * that end in bins. A read pair is counted at its end when the
+         * distance is at most the cut-off, which is either the end
+         * length or half the length of the contig. Position
+         * (size + 1) / 2 of a contig of odd length is never counted.
+         */
+        static uint32_t end(int pos, int size)
+        {
+            const int head = pos, tail = size - pos + 1;
+            const int dist = std::min(head, tail);
+            const uint32_t bin = dist <= 0 ? 0
+                : dist > size / 2 ? CENTER_BIN
+                : (dist + BIN_SIZE - 1) / BIN_SIZE;
+            return 2 * bin + (head <= tail);
+        }
+
+        Evidence() : m_header(NULL) { }
+
+        /** Map the evidence file at path. */
+        void open(const std::string& path)
+        {
+            m_path = path;
+            if (!m_file.open(path))
+                die("cannot map the file");
+            const char* p = m_file.data();
+            const char* end = p + m_file.size();
+            if (m_file.size() < sizeof (Header))
+                die("not an ARCS evidence file");
+            m_header = reinterpret_cast<const Header*>(p);
+            if (memcmp(m_header->magic, magic(), sizeof m_header->magic) != 0)
+                die("not an ARCS evidence file");
+            if (m_header->byteOrder != BYTE_ORDER_MARK)
+                die("written on a machine of different byte order");
+            if (m_header->version != FORMAT_VERSION)
+                die("unsupported version");
+            if (m_header->binSize != BIN_SIZE)
+                die("unsupported bin size");
+            p += sizeof (Header);
+
+            const Header& h = *m_header;
+            m_lengths = section<int32_t>(p, end, h.numContigs);
+            m_nameOffsets = section<uint64_t>(p, end, h.numContigs + 1);
+            m_names = section<char>(p, end, h.namesSize);
+            m_scaffolds = section<Scaffold>(p, end, h.numScaffolds);
+            m_fallbackOffsets = section<uint64_t>(p, end, h.numFallbackBarcodes + 1);
+            m_fallbackNames = section<char>(p, end, h.fallbackSize);
+            m_barcodes = section<BarcodeID>(p, end, h.numBarcodes);
+            m_multiplicities = section<int32_t>(p, end, h.numBarcodes);
+            m_offsets = section<uint64_t>(p, end, h.numBarcodes + 1);
+            m_entries = section<Entry>(p, end, h.numEntries);
+            if (!isSorted(m_nameOffsets, h.numContigs, h.namesSize)
+                    || !isSorted(m_fallbackOffsets, h.numFallbackBarcodes, h.fallbackSize)
+                    || !isSorted(m_offsets, h.numBarcodes, h.numEntries))
+                die("corrupt file");
+        }
+
+        /**
+         * Add the contigs and input scaffolds of the evidence to the
+         * empty contigs and scaffSizeList, and its fallback barcodes
+         * to the unused codec, so that the IDs of the contigs and
+         * barcodes are those of the evidence.
+         */
+        void load(Contigs& contigs, ScaffSizeList& scaffSizeList,
+                BarcodeCodec& codec) const
+        {
+            assert(contigs.empty());
+            for (ContigID i = 0; i < m_header->numContigs; ++i)
+                contigs.add(name(m_nameOffsets, m_names, i), m_lengths[i]);
+            if (contigs.size() != m_header->numContigs)
+                die("corrupt file");
+            scaffSizeList.reserve(m_header->numScaffolds);
+            for (uint64_t i = 0; i < m_header->numScaffolds; ++i) {
+                const Scaffold& s = m_scaffolds[i];
+                if (s.contig >= m_header->numContigs)
+                    die("corrupt file");
+                scaffSizeList.push_back(std::make_pair(
+                            std::string(contigs.name(s.contig)), s.length));
+            }
+            for (uint64_t i = 0; i < m_header->numFallbackBarcodes; ++i) {
+                const std::string barcode = name(m_fallbackOffsets, m_fallbackNames, i);
+                if (codec.encode(StringSpan(barcode)) != (FALLBACK_BIT | i))
+                    die("corrupt file");
+            }
+        }
+
+        /**
+         * Build the IndexTable itable and the IndexMultMap indexMultMap
+         * for the parameters -e endLength and -z minSize, as reading
+         * the alignments would.
+         */
+        void buildTable(int endLength, int minSize,
+                IndexTable& itable, IndexMultMap& indexMultMap) const
+        {
+            assert(endLength % BIN_SIZE == 0);
+            const uint32_t maxBin = endLength / BIN_SIZE;
+            const uint64_t numBarcodes = m_header->numBarcodes;
+            indexMultMap.reserve(numBarcodes);
+            itable.offsets.push_back(0);
+            for (uint64_t i = 0; i < numBarcodes; ++i) {
+                indexMultMap[m_barcodes[i]] = m_multiplicities[i];
+                const size_t first = itable.contigs.size();
+                for (const Entry* e = m_entries + m_offsets[i];
+                        e != m_entries + m_offsets[i + 1]; ++e) {
+                    if (e->contig >= m_header->numContigs)
+                        die("corrupt file");
+                    const int size = m_lengths[e->contig];
+                    const uint32_t bin = e->end / 2;
+                    if (size < minSize)
+                        continue;
+                    // See addReadPair.
+                    if (endLength == 0 || size <= endLength * 2
+                            ? bin == CENTER_BIN : bin > maxBin)
+                        continue;
+                    if (itable.contigs.size() == first
+                            || itable.contigs.back().contig != e->contig) {
+                        ContigEndCounts counts = { e->contig, 0, 0 };
+                        itable.contigs.push_back(counts);
+                    }
+                    if (e->end & 1)
+                        itable.contigs.back().head += e->count;
+                    else
+                        itable.contigs.back().tail += e->count;
+                }
+                if (itable.contigs.size() > first) {
+                    itable.barcodes.push_back(m_barcodes[i]);
+                    itable.multiplicities.push_back(m_multiplicities[i]);
+                    itable.offsets.push_back(itable.contigs.size());
+                }
+            }
+        }
+
+        /**
+         * Write the evidence of the IndexMap imap, which is keyed by
+         * the ends of Evidence::end, and of the IndexMultMap
+         * indexMultMap to path, and clear imap. Renumber the contigs
+         * of imap with newIDs, the new ID of each contig indexed by
+         * its old ID. The contigs are numbered by their new IDs.
+         */
+        static void write(const std::string& path, IndexMap& imap,
+                const IndexMultMap& indexMultMap,
+                const std::vector<ContigID>& newIDs, const Contigs& contigs,
+                const ScaffSizeList& scaffSizeList, const BarcodeCodec& codec)
+        {
+            std::ofstream out(path.c_str(), std::ios::binary);
+            if (!out)
+                die(path, "cannot open the file");
+
+            Header h;
+            memset(&h, 0, sizeof h);
+            memcpy(h.magic, magic(), sizeof h.magic);
+            h.byteOrder = BYTE_ORDER_MARK;
+            h.version = FORMAT_VERSION;
+            h.binSize = BIN_SIZE;
+            h.numContigs = contigs.size();
+            for (ContigID i = 0; i < contigs.size(); ++i)
+                h.namesSize += strlen(contigs.name(i));
+            h.numScaffolds = scaffSizeList.size();
+            h.numFallbackBarcodes = codec.fallbackSize();
+            std::vector<std::string> fallbackNames;
+            fallbackNames.reserve(h.numFallbackBarcodes);
+            for (uint64_t i = 0; i < h.numFallbackBarcodes; ++i) {
+                fallbackNames.push_back(codec.decode(FALLBACK_BIT | i));
+                h.fallbackSize += fallbackNames.back().size();
+            }
+
+            std::vector<BarcodeID> barcodes;
+            barcodes.reserve(indexMultMap.size());
+            for (const auto& x : indexMultMap)
+                barcodes.push_back(x.first);
+            std::sort(barcodes.begin(), barcodes.end());
+            h.numBarcodes = barcodes.size();
+            for (const auto& x : imap)
+                h.numEntries += x.second.size();
+            writeSection(out, &h, 1);
+
+            std::vector<int32_t> lengths(contigs.lengths().begin(), contigs.lengths().end());
+            writeSection(out, lengths.data(), lengths.size());
+            std::vector<uint64_t> offsets(1, 0);
+            std::string names;
+            names.reserve(h.namesSize);
+            for (ContigID i = 0; i < contigs.size(); ++i) {
+                names += contigs.name(i);
+                offsets.push_back(names.size());
+            }
+            writeSection(out, offsets.data(), offsets.size());
+            writeSection(out, names.data(), names.size());
+
+            std::vector<Scaffold> scaffolds;
+            scaffolds.reserve(scaffSizeList.size());
+            for (const auto& x : scaffSizeList) {
+                Scaffold s = { 0, x.second };
+                bool found = contigs.find(x.first, s.contig);
+                assert(found);
+                (void)found;
+                scaffolds.push_back(s);
+            }
+            writeSection(out, scaffolds.data(), scaffolds.size());
+
+            offsets.assign(1, 0);
+            names.clear();
+            for (const auto& name : fallbackNames) {
+                names += name;
+                offsets.push_back(names.size());
+            }
+            writeSection(out, offsets.data(), offsets.size());
+            writeSection(out, names.data(), names.size());
+
+            writeSection(out, barcodes.data(), barcodes.size());
+            std::vector<int32_t> multiplicities;
+            multiplicities.reserve(barcodes.size());
+            for (BarcodeID barcode : barcodes)
+                multiplicities.push_back(indexMultMap.at(barcode));
+            writeSection(out, multiplicities.data(), multiplicities.size());
+            std::vector<int32_t>().swap(multiplicities);
+
+            offsets.assign(1, 0);
+            for (BarcodeID barcode : barcodes) {
+                auto it = imap.find(barcode);
+                offsets.push_back(offsets.back()
+                        + (it == imap.end() ? 0 : it->second.size()));
+            }
+            writeSection(out, offsets.data(), offsets.size());
+
+            std::vector<Entry> entries;
+            for (BarcodeID barcode : barcodes) {
+                auto it = imap.find(barcode);
+                if (it == imap.end())
+                    continue;
+                entries.clear();
+                for (const auto& x : it->second) {
+                    Entry e = { newIDs[x.first.first], x.first.second, x.second };
+                    entries.push_back(e);
+                }
+                std::sort(entries.begin(), entries.end(),
+                        [](const Entry& a, const Entry& b) {
+                            return a.contig != b.contig ? a.contig < b.contig
+                                : a.end < b.end;
+                        });
+                out.write(reinterpret_cast<const char*>(entries.data()),
+                        entries.size() * sizeof (Entry));
+                // Free the memory of the IndexMap as the file grows.
+                imap.erase(it);
+            }
+            assert(imap.empty());
+            out.write(std::string(8, '\0').data(),
+                    (8 - h.numEntries * sizeof (Entry) % 8) % 8);
+            out.close();
+            if (!out)
+                die(path, "cannot write the file");
+        }
+
+      private:
+        Evidence(const Evidence&);
+        Evidence& operator=(const Evidence&);
+
+        static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+        static const uint32_t CENTER_BIN = UINT32_MAX / 2;
+        static const BarcodeID FALLBACK_BIT = BarcodeID(1) << 63;
+
+        struct Header {
+            char magic[8];
+            uint32_t byteOrder;
+            uint32_t version;
+            uint32_t binSize;
+            uint32_t unused;
+            uint64_t numContigs;
+            uint64_t namesSize;
+            uint64_t numScaffolds;
+            uint64_t numFallbackBarcodes;
+            uint64_t fallbackSize;
+            uint64_t numBarcodes;
+            uint64_t numEntries;
+        };
+
+        struct Scaffold {
+            ContigID contig;
+            int32_t length;
+        };
+
+        /* The first eight bytes of the file */
+        static const char* magic() { return "ARCSEVD"; }
+
+        static void die(const std::string& path, const char* message)
+        {
+            std::cerr << "error: `" << path << "': " << message << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        void die(const char* message) const { die(m_path, message); }
+
+        /* Return the array of n elements at p, and skip it and its padding. */
+        template <typename T>
+        const T* section(const char*& p, const char* end, uint64_t n) const
+        {
+            const T* array = reinterpret_cast<const T*>(p);
+            const uint64_t size = (n * sizeof (T) + 7) / 8 * 8;
+            if (uint64_t(end - p) < size)
+                die("truncated file");
+            p += size;
+            return array;
+        }
+
+        /* Write an array of n elements, padded to eight bytes. */
+        template <typename T>
+        static void writeSection(std::ofstream& out, const T* array, uint64_t n)
+        {
+            static const char padding[8] = { 0 };
+            const uint64_t size = n * sizeof (T);
+            out.write(reinterpret_cast<const char*>(array), size);
+            out.write(padding, (8 - size % 8) % 8);
+        }
+
+        /* Return whether the n + 1 offsets are sorted from 0 to last. */
+        static bool isSorted(const uint64_t* offsets, uint64_t n, uint64_t last)
+        {
+            return offsets[0] == 0 && offsets[n] == last
+                && std::is_sorted(offsets, offsets + n + 1);
+        }
+
+        /* Return the name i of a table of names. */
+        static std::string name(const uint64_t* offsets, const char* names, uint64_t i)
+        {
+            return std::string(names + offsets[i], names + offsets[i + 1]);
+        }
+
+        std::string m_path;
+        MappedFile m_file;
+        const Header* m_header;
+        const int32_t* m_lengths;
+        const uint64_t* m_nameOffsets;
+        const char* m_names;
+        const Scaffold* m_scaffolds;
+        const uint64_t* m_fallbackOffsets;
+        const char* m_fallbackNames;
+        const BarcodeID* m_barcodes;
+        const int32_t* m_multiplicities;
+        const uint64_t* m_offsets;
+        const Entry* m_entries;
+    };
+
+}
+
+#endif
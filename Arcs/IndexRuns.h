@@ -0,0 +1,504 @@
+#ifndef ARCS_INDEXRUNS_H
+#define ARCS_INDEXRUNS_H 1
+
+#include "Arcs/Arcs.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace ARCS {
+
+    /**
+     * Sorted runs of the IndexMap and IndexMultMap in temporary files,
+     * which bound the memory used to read the alignments.
+     * When the maps reach the memory limit, they are written to a run
+     * sorted by barcode and contig, and cleared. Once all the alignments
+     * have been read, a k-way merge of the runs sums the counts of each
+     * barcode and contig, and builds the IndexTable in barcode order.
+     * When there are MAX_RUNS runs that have been merged the same
+     * number of times, they are merged into one run, so that the
+     * number of open files grows with the logarithm of the input.
+     * The temporary files are created in $TMPDIR, or /tmp, and are
+     * unlinked as soon as they are created.
+     */
+    class IndexRuns
+    {
+      public:
+        /* The approximate memory used by each element of the maps */
+        static const size_t BARCODE_BYTES = 88;
+        static const size_t END_BYTES = 48;
+        static const size_t MULT_BYTES = 40;
+
+        IndexRuns() : m_limit(0), m_counts(NULL) { }
+
+        ~IndexRuns()
+        {
+            if (m_counts != NULL)
+                fclose(m_counts);
+            for (const auto& run : m_runs)
+                fclose(run.first);
+        }
+
+        /**
+         * Set the memory limit of each pair of maps, in bytes.
+         * Zero disables the limit.
+         */
+        void setLimit(size_t limit) { m_limit = limit; }
+
+        /** Return whether the memory of the maps is limited. */
+        bool enabled() const { return m_limit > 0; }
+
+        /** Return the number of runs. */
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_runs.size();
+        }
+
+        /** Return the number of scaffold ends of the IndexMap. */
+        static size_t countEnds(const IndexMap& imap)
+        {
+            size_t n = 0;
+            for (const auto& x : imap)
+                n += x.second.size();
+            return n;
+        }
+
+        /**
+         * Return whether the maps exceed the memory limit, where
+         * numEnds is the number of scaffold ends of imap.
+         */
+        bool full(const IndexMap& imap, size_t numEnds,
+                const IndexMultMap& indexMultMap) const
+        {
+            return enabled() && imap.size() * BARCODE_BYTES
+                + numEnds * END_BYTES
+                + indexMultMap.size() * MULT_BYTES > m_limit;
+        }
+
+        /**
+         * Write the maps to a new run, and clear them. This function
+         * may be called by several threads concurrently.
+         */
+        void spill(IndexMap& imap, IndexMultMap& indexMultMap)
+        {
+            if (imap.empty() && indexMultMap.empty())
+                return;
+
+            // A read pair may be added to the IndexMap after its
+            // barcode was counted and spilled, so that a barcode may be
+            // in the IndexMap and not in the IndexMultMap.
+            std::vector<BarcodeID> barcodes;
+            barcodes.reserve(indexMultMap.size());
+            for (const auto& x : indexMultMap)
+                barcodes.push_back(x.first);
+            for (const auto& x : imap)
+                if (indexMultMap.count(x.first) == 0)
+                    barcodes.push_back(x.first);
+            std::sort(barcodes.begin(), barcodes.end());
+
+            RunWriter out(createTempFile());
+            for (BarcodeID barcode : barcodes) {
+                // The ends of a contig are adjacent in the ScafMap,
+                // which is sorted by contig.
+                auto it = imap.find(barcode);
+                if (it != imap.end()) {
+                    Record rec = { barcode, NO_CONTIG, 0, 0 };
+                    for (const auto& x : it->second) {
+                        if (x.first.first != rec.contig) {
+                            if (rec.contig != NO_CONTIG)
+                                out.write(rec);
+                            rec.contig = x.first.first;
+                            rec.head = rec.tail = 0;
+                        }
+                        if (x.first.second)
+                            rec.head = x.second;
+                        else
+                            rec.tail = x.second;
+                    }
+                    if (rec.contig != NO_CONTIG)
+                        out.write(rec);
+                    imap.erase(it);
+                }
+                auto mult = indexMultMap.find(barcode);
+                if (mult != indexMultMap.end()) {
+                    Record rec = { barcode, NO_CONTIG, mult->second, 0 };
+                    out.write(rec);
+                }
+            }
+            assert(imap.empty());
+            IndexMap().swap(imap);
+            IndexMultMap().swap(indexMultMap);
+
+            addRun(out.close(), 0);
+        }
+
+        /**
+         * Merge the runs into the IndexTable itable, and close the
+         * runs. Renumber the contigs with newIDs, the new ID of each
+         * contig indexed by its old ID. Add to indexMultMap the
+         * multiplicities from minMult to maxMult. With saveCounts,
+         * save the multiplicity of every barcode for forEachCount.
+         * @return the number of barcodes
+         */
+        size_t merge(const std::vector<ContigID>& newIDs, IndexTable& itable,
+                IndexMultMap& indexMultMap, int minMult, int maxMult,
+                bool saveCounts)
+        {
+            std::unique_ptr<RunWriter> counts;
+            if (saveCounts)
+                counts.reset(new RunWriter(createTempFile()));
+            TableBuilder table(newIDs, itable, indexMultMap, minMult, maxMult,
+                    counts.get());
+            std::vector<FILE*> runs;
+            for (const auto& run : m_runs)
+                runs.push_back(run.first);
+            m_runs.clear();
+            mergeRuns(runs, [&table](const Record& rec) { table.add(rec); });
+            table.finish();
+            if (counts)
+                m_counts = counts->close();
+            return table.numBarcodes();
+        }
+
+        /**
+         * Call f for batches of at most about batchSize barcodes and
+         * their multiplicities saved by merge, in descending order of
+         * multiplicity. The multiplicities of the barcodes of a batch
+         * are greater than those of the next batch. Each batch is read
+         * from the saved multiplicities, so that they need not fit in
+         * memory.
+         */
+        template <typename F>
+        void forEachCount(size_t batchSize, F f)
+        {
+            assert(m_counts != NULL);
+            std::map<int, size_t, std::greater<int>> histogram;
+            RunReader in(m_counts, 1 << 12);
+            for (Record rec; in.read(rec);)
+                ++histogram[rec.head];
+
+            std::vector<std::pair<BarcodeID, int>> batch;
+            for (auto it = histogram.begin(); it != histogram.end();) {
+                // The multiplicities from it to last are in the batch.
+                int first = it->first, last = it->first;
+                size_t n = 0;
+                for (; it != histogram.end()
+                        && (n == 0 || n + it->second <= batchSize); ++it) {
+                    n += it->second;
+                    last = it->first;
+                }
+                batch.clear();
+                batch.reserve(n);
+                RunReader in(m_counts, 1 << 12);
+                for (Record rec; in.read(rec);)
+                    if (rec.head <= first && rec.head >= last)
+                        batch.push_back(std::make_pair(rec.barcode, rec.head));
+                f(batch);
+            }
+            fclose(m_counts);
+            m_counts = NULL;
+        }
+
+      private:
+        IndexRuns(const IndexRuns&);
+        IndexRuns& operator=(const IndexRuns&);
+
+        /* The number of runs that are merged into one */
+        static const size_t MAX_RUNS = 64;
+
+        /* The contig of the record of the multiplicity of a barcode */
+        static const ContigID NO_CONTIG = std::numeric_limits<ContigID>::max();
+
+        /*
+         * The counts of a barcode and contig, or the multiplicity of a
+         * barcode in head when contig is NO_CONTIG. The records of a
+         * run are sorted by barcode and contig, so that the
+         * multiplicity of a barcode follows its contigs.
+         */
+        struct Record {
+            BarcodeID barcode;
+            ContigID contig;
+            int head;
+            int tail;
+
+            bool operator<(const Record& o) const
+            {
+                return barcode != o.barcode ? barcode < o.barcode
+                    : contig < o.contig;
+            }
+        };
+
+        static void die(const char* what)
+        {
+            std::cerr << "error: " << what << " temporary file: "
+                << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        /*
+         * Add a run of the specified level. When there are MAX_RUNS
+         * runs of that level, merge them into one run of the next
+         * level, while other threads add new runs.
+         */
+        void addRun(FILE* run, unsigned level)
+        {
+            std::vector<FILE*> runs;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_runs.push_back(std::make_pair(run, level));
+                size_t n = std::count_if(m_runs.begin(), m_runs.end(),
+                        [level](const std::pair<FILE*, unsigned>& x) {
+                            return x.second == level;
+                        });
+                if (n < MAX_RUNS)
+                    return;
+                for (auto it = m_runs.begin(); it != m_runs.end();) {
+                    if (it->second == level) {
+                        runs.push_back(it->first);
+                        it = m_runs.erase(it);
+                    } else
+                        ++it;
+                }
+            }
+            RunWriter merged(createTempFile());
+            mergeRuns(runs, [&merged](const Record& rec) { merged.write(rec); });
+            addRun(merged.close(), level + 1);
+        }
+
+        /*
+         * Merge the runs, summing the counts of each barcode and
+         * contig, call sink for each record in order, and close the
+         * runs.
+         */
+        template <typename Sink>
+        void mergeRuns(std::vector<FILE*>& runs, Sink sink) const
+        {
+            // Divide half of the total memory limit among the buffers
+            // of the runs.
+            const size_t bufferSize = std::min<size_t>(1 << 16,
+                    std::max<size_t>(1 << 10, m_limit / 2
+                        / (runs.size() * sizeof (Record))));
+            std::vector<RunReader> readers;
+            readers.reserve(runs.size());
+            for (FILE* f : runs)
+                readers.push_back(RunReader(f, bufferSize));
+
+            typedef std::pair<Record, size_t> Entry;
+            std::priority_queue<Entry, std::vector<Entry>,
+                std::greater<Entry>> queue;
+            for (size_t i = 0; i < readers.size(); ++i) {
+                Record rec;
+                if (readers[i].read(rec))
+                    queue.push(Entry(rec, i));
+            }
+
+            Record sum = { 0, NO_CONTIG, 0, 0 };
+            bool empty = true;
+            while (!queue.empty()) {
+                Entry entry = queue.top();
+                queue.pop();
+                Record rec;
+                if (readers[entry.second].read(rec))
+                    queue.push(Entry(rec, entry.second));
+
+                const Record& x = entry.first;
+                if (!empty && x.barcode == sum.barcode && x.contig == sum.contig) {
+                    sum.head += x.head;
+                    sum.tail += x.tail;
+                } else {
+                    if (!empty)
+                        sink(sum);
+                    sum = x;
+                    empty = false;
+                }
+            }
+            if (!empty)
+                sink(sum);
+
+            for (FILE* f : runs)
+                fclose(f);
+            runs.clear();
+        }
+
+        /* Create an unlinked temporary file. */
+        static FILE* createTempFile()
+        {
+            const char* dir = getenv("TMPDIR");
+            std::string path = std::string(dir != NULL && *dir != '\0'
+                    ? dir : "/tmp") + "/arcs.XXXXXX";
+            int fd = mkstemp(&path[0]);
+            if (fd < 0) {
+                std::cerr << "error: `" << path << "': "
+                    << strerror(errno) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            unlink(path.c_str());
+            FILE* f = fdopen(fd, "w+b");
+            if (f == NULL)
+                die("opening");
+            return f;
+        }
+
+        /* Write the records of a run. */
+        class RunWriter
+        {
+          public:
+            explicit RunWriter(FILE* f) : m_f(f) { m_buf.reserve(BUFFER_SIZE); }
+
+            void write(const Record& rec)
+            {
+                m_buf.push_back(rec);
+                if (m_buf.size() == BUFFER_SIZE)
+                    flush();
+            }
+
+            /* Flush the run and return its file. */
+            FILE* close()
+            {
+                flush();
+                if (fflush(m_f) != 0)
+                    die("writing");
+                return m_f;
+            }
+
+          private:
+            static const size_t BUFFER_SIZE = 1 << 12;
+
+            void flush()
+            {
+                if (fwrite(m_buf.data(), sizeof (Record), m_buf.size(), m_f)
+                        != m_buf.size())
+                    die("writing");
+                m_buf.clear();
+            }
+
+            FILE* m_f;
+            std::vector<Record> m_buf;
+        };
+
+        /* Read the records of a run from its beginning. */
+        class RunReader
+        {
+          public:
+            RunReader(FILE* f, size_t bufferSize)
+                : m_f(f), m_buf(bufferSize), m_pos(0), m_size(0)
+            {
+                rewind(m_f);
+            }
+
+            /** @return false at the end of the run */
+            bool read(Record& rec)
+            {
+                if (m_pos == m_size) {
+                    m_size = fread(m_buf.data(), sizeof (Record), m_buf.size(), m_f);
+                    m_pos = 0;
+                    if (m_size == 0) {
+                        if (ferror(m_f))
+                            die("reading");
+                        return false;
+                    }
+                }
+                rec = m_buf[m_pos++];
+                return true;
+            }
+
+          private:
+            FILE* m_f;
+            std::vector<Record> m_buf;
+            size_t m_pos, m_size;
+        };
+
+        /* Build the IndexTable from the merged records in order. */
+        class TableBuilder
+        {
+          public:
+            TableBuilder(const std::vector<ContigID>& newIDs, IndexTable& itable,
+                    IndexMultMap& indexMultMap, int minMult, int maxMult,
+                    RunWriter* counts)
+                : m_newIDs(newIDs), m_itable(itable), m_indexMultMap(indexMultMap),
+                m_minMult(minMult), m_maxMult(maxMult), m_counts(counts),
+                m_barcode(0), m_first(0), m_numBarcodes(0)
+            {
+                m_itable.offsets.push_back(0);
+            }
+
+            void add(const Record& rec)
+            {
+                if (rec.barcode != m_barcode)
+                    finish();
+                m_barcode = rec.barcode;
+                if (rec.contig == NO_CONTIG) {
+                    ++m_numBarcodes;
+                    if (rec.head >= m_minMult && rec.head <= m_maxMult)
+                        m_indexMultMap[rec.barcode] = rec.head;
+                    if (m_counts != NULL)
+                        m_counts->write(rec);
+                    if (m_itable.contigs.size() > m_first)
+                        m_itable.multiplicities.push_back(rec.head);
+                } else {
+                    ContigEndCounts counts = { m_newIDs[rec.contig], rec.head, rec.tail };
+                    m_itable.contigs.push_back(counts);
+                }
+            }
+
+            /* Finish the current barcode. */
+            void finish()
+            {
+                if (m_itable.contigs.size() == m_first)
+                    return;
+                if (m_itable.multiplicities.size() == m_itable.barcodes.size()) {
+                    // The barcode has no multiplicity with --barcode-sketch.
+                    m_itable.contigs.resize(m_first);
+                    return;
+                }
+                assert(m_itable.multiplicities.size() == m_itable.barcodes.size() + 1);
+                std::sort(m_itable.contigs.begin() + m_first, m_itable.contigs.end(),
+                        [](const ContigEndCounts& a, const ContigEndCounts& b) {
+                            return a.contig < b.contig;
+                        });
+                m_itable.barcodes.push_back(m_barcode);
+                m_itable.offsets.push_back(m_itable.contigs.size());
+                m_first = m_itable.contigs.size();
+            }
+
+            /* Return the number of barcodes. */
+            size_t numBarcodes() const { return m_numBarcodes; }
+
+          private:
+            const std::vector<ContigID>& m_newIDs;
+            IndexTable& m_itable;
+            IndexMultMap& m_indexMultMap;
+            int m_minMult, m_maxMult;
+            RunWriter* m_counts;
+            BarcodeID m_barcode;
+            size_t m_first;
+            size_t m_numBarcodes;
+        };
+
+        size_t m_limit;
+        mutable std::mutex m_mutex;
+        /* The runs, and the number of times each has been merged */
+        std::vector<std::pair<FILE*, unsigned>> m_runs;
+        /* The multiplicities of the barcodes saved by merge */
+        FILE* m_counts;
+    };
+
+}
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef ARCS_SHAREDBARCODES_H
+#define ARCS_SHAREDBARCODES_H 1
+
+#include "Arcs/Arcs.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#if _OPENMP
+# include <omp.h>
+#endif
+
+namespace ARCS {
+
+    /**
+     * The numbers of barcodes shared by the ends of pairs of contigs,
+     * which is the sparse matrix product B B^T of the incidence matrix
+     * B of contig ends and barcodes.
+     * B^T is stored in compressed sparse row format by barcode, with the
+     * ends of each barcode sorted by contig, and B by contig end, with
+     * the position of each of its barcodes in B^T. The product is
+     * computed row by row (Gustavson's algorithm) for the pairs of
+     * contigs A < B, by several threads that each sum a row in a hash
+     * table, whose size is proportional to the products of the row
+     * rather than to the number of contigs. The pairs that pass a
+     * filter are appended in order, so that the memory of the product
+     * is proportional to its output.
+     * The four counts of a pair are its orientations Head-Head,
+     * Head-Tail, Tail-Head and Tail-Tail, as in PairMap.
+     */
+    class SharedBarcodes
+    {
+      public:
+        typedef PairMap::Counts Counts;
+        typedef PairMap::Entry Entry;
+
+        /** The contig ends of a barcode in B */
+        enum { TAIL = 1, HEAD = 2 };
+
+        /**
+         * Build B from the barcodes of itable whose multiplicities are
+         * in the range of params. select(counts) returns the ends of a
+         * contig of a barcode that are in B, as TAIL and HEAD bits.
+         */
+        template <typename Select>
+        SharedBarcodes(const IndexTable& itable, const ArcsParams& params,
+                Select select)
+            : m_numContigs(0)
+        {
+            // Build B^T. An end is numbered 2 * contig + isHead.
+            m_barcodeOffsets.push_back(0);
+            for (size_t i = 0; i < itable.size(); ++i) {
+                int indexMult = itable.multiplicities[i];
+                if (indexMult < params.min_mult || indexMult > params.max_mult)
+                    continue;
+                for (auto o = itable.begin(i); o != itable.end(i); ++o) {
+                    unsigned ends = select(*o);
+                    if (ends & TAIL)
+                        m_ends.push_back(2 * o->contig);
+                    if (ends & HEAD)
+                        m_ends.push_back(2 * o->contig + 1);
+                    if (ends != 0)
+                        m_numContigs = std::max<size_t>(m_numContigs, o->contig + 1);
+                }
+                if (m_ends.size() > m_barcodeOffsets.back())
+                    m_barcodeOffsets.push_back(m_ends.size());
+            }
+
+            // Build B by a counting sort of B^T by contig end.
+            m_endOffsets.assign(2 * m_numContigs + 1, 0);
+            for (uint32_t end : m_ends)
+                ++m_endOffsets[end + 1];
+            for (size_t i = 1; i < m_endOffsets.size(); ++i)
+                m_endOffsets[i] += m_endOffsets[i - 1];
+            m_barcodes.resize(m_ends.size());
+            std::vector<size_t> next(m_endOffsets.begin(), m_endOffsets.end() - 1);
+            for (size_t i = 0; i + 1 < m_barcodeOffsets.size(); ++i)
+                for (size_t pos = m_barcodeOffsets[i]; pos < m_barcodeOffsets[i + 1]; ++pos)
+                    m_barcodes[next[m_ends[pos]]++]
+                        = std::make_pair(pos, m_barcodeOffsets[i + 1]);
+        }
+
+        /** Return the number of barcodes of an end of a contig. */
+        size_t barcodes(ContigID contig, bool isHead) const
+        {
+            size_t end = 2 * size_t(contig) + isHead;
+            if (end + 1 >= m_endOffsets.size())
+                return 0;
+            return m_endOffsets[end + 1] - m_endOffsets[end];
+        }
+
+        /**
+         * Append to out the pairs of contigs A < B that share a
+         * barcode and for which keep(A, B, counts) is true, sorted by
+         * contig IDs, using the specified number of threads.
+         */
+        template <typename Keep>
+        void multiply(unsigned threads, Keep keep, std::vector<Entry>& out) const
+        {
+            // Each task sums the rows of a block of contigs.
+            const size_t BLOCK_SIZE = 256;
+            const size_t numBlocks = (m_numContigs + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            std::vector<std::vector<Entry>> blocks(numBlocks);
+
+#if _OPENMP
+            #pragma omp parallel num_threads(threads)
+#else
+            (void)threads;
+#endif
+            {
+                Accumulator acc;
+#if _OPENMP
+                #pragma omp for schedule(dynamic, 1)
+#endif
+                for (size_t i = 0; i < numBlocks; ++i) {
+                    size_t end = std::min(m_numContigs, (i + 1) * BLOCK_SIZE);
+                    for (size_t contig = i * BLOCK_SIZE; contig < end; ++contig)
+                        multiplyRow(ContigID(contig), acc, keep, blocks[i]);
+                }
+            }
+
+            size_t size = out.size();
+            for (const auto& block : blocks)
+                size += block.size();
+            out.reserve(size);
+            for (auto& block : blocks) {
+                out.insert(out.end(), block.begin(), block.end());
+                std::vector<Entry>().swap(block);
+            }
+        }
+
+        /**
+         * Return the number of threads of params to multiply with.
+         * The parameter sets of a sweep already run in parallel.
+         */
+        static unsigned threads(const ArcsParams& params)
+        {
+#if _OPENMP
+            if (!omp_in_parallel())
+                return std::max(1u, params.threads);
+#endif
+            (void)params;
+            return 1;
+        }
+
+      private:
+        /*
+         * The counts of the contigs of a row in an open-addressing hash
+         * table, and the slots touched by the row.
+         */
+        class Accumulator
+        {
+          public:
+            Accumulator() : m_shift(64) { }
+
+            /* Make room for the n contigs of the next row. */
+            void reserve(size_t n)
+            {
+                assert(m_touched.empty());
+                if (2 * n <= m_keys.size())
+                    return;
+                unsigned bits = 4;
+                while ((size_t(1) << bits) < 2 * n)
+                    ++bits;
+                m_keys.assign(size_t(1) << bits, ContigID(NONE));
+                m_counts.assign(size_t(1) << bits, Counts());
+                m_shift = 64 - bits;
+            }
+
+            /* Return the counts of contig b. */
+            Counts& operator[](ContigID b)
+            {
+                size_t mask = m_keys.size() - 1;
+                size_t i = (uint64_t(b) * 0x9e3779b97f4a7c15ull) >> m_shift;
+                for (; m_keys[i] != b; i = (i + 1) & mask) {
+                    if (m_keys[i] == NONE) {
+                        m_keys[i] = b;
+                        m_touched.push_back(i);
+                        break;
+                    }
+                }
+                return m_counts[i];
+            }
+
+            /* Call f(b, counts) for the contigs touched in order, and clear them. */
+            template <typename F>
+            void flush(F f)
+            {
+                const std::vector<ContigID>& keys = m_keys;
+                std::sort(m_touched.begin(), m_touched.end(),
+                        [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+                for (size_t i : m_touched) {
+                    f(m_keys[i], m_counts[i]);
+                    m_keys[i] = NONE;
+                    m_counts[i] = Counts();
+                }
+                m_touched.clear();
+            }
+
+          private:
+            static const ContigID NONE = std::numeric_limits<ContigID>::max();
+
+            std::vector<ContigID> m_keys;
+            std::vector<Counts> m_counts;
+            std::vector<size_t> m_touched;
+            unsigned m_shift;
+        };
+
+        /* Sum the row of contig A, and append the pairs A < B to out. */
+        template <typename Keep>
+        void multiplyRow(ContigID a, Accumulator& acc, Keep& keep,
+                std::vector<Entry>& out) const
+        {
+            // The contigs of the row are at most its products.
+            size_t products = 0;
+            for (size_t i = m_endOffsets[2 * size_t(a)];
+                    i < m_endOffsets[2 * size_t(a) + 2]; ++i)
+                products += m_barcodes[i].second - m_barcodes[i].first - 1;
+            acc.reserve(std::min(products, m_numContigs));
+
+            for (size_t end = 2 * size_t(a); end <= 2 * size_t(a) + 1; ++end) {
+                bool aHead = end & 1;
+                for (size_t i = m_endOffsets[end]; i < m_endOffsets[end + 1]; ++i) {
+                    // The ends of the barcode after A are of contigs B > A,
+                    // except the other end of A.
+                    for (size_t pos = m_barcodes[i].first + 1;
+                            pos < m_barcodes[i].second; ++pos) {
+                        ContigID b = m_ends[pos] >> 1;
+                        if (b == a)
+                            continue;
+                        bool bHead = m_ends[pos] & 1;
+                        ++acc[b][2 * !aHead + !bHead];
+                    }
+                }
+            }
+
+            acc.flush([a, &keep, &out](ContigID b, const Counts& counts) {
+                if (keep(a, b, counts)) {
+                    Entry e = { uint64_t(a) << 32 | b, counts };
+                    out.push_back(e);
+                }
+            });
+        }
+
+        /* The number of contigs, one more than the largest contig ID of B */
+        size_t m_numContigs;
+
+        /* B^T: the ends of barcode i are m_ends[m_barcodeOffsets[i]] to m_ends[m_barcodeOffsets[i + 1]] */
+        std::vector<uint32_t> m_ends;
+        std::vector<size_t> m_barcodeOffsets;
+
+        /* B: the position in m_ends of each barcode of each end, and the end of its barcode */
+        std::vector<std::pair<size_t, size_t>> m_barcodes;
+        std::vector<size_t> m_endOffsets;
+    };
+
+}
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef BAM_H
+#define BAM_H 1
+
+#include "Common/BGZF.h"
+#include "Common/StringUtil.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Return the little-endian integer of type T at p. */
+template <typename T>
+static inline T getLittleEndian(const char* p)
+{
+    T x;
+    memcpy(&x, p, sizeof x);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    char* q = reinterpret_cast<char*>(&x);
+    std::reverse(q, q + sizeof x);
+#endif
+    return x;
+}
+
+/** 1 for the BAM CIGAR operations that are aligned and consume the
+ * query (M, I, = and X), indexed by operation, and 0 otherwise.
+ */
+static constexpr unsigned char BAM_CIGAR_QUERY_OP[16] = {
+    1, 1, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0
+};
+
+/**
+ * A BAM alignment record, decoded from the binary record without
+ * copying. It has the same interface as SAMRecord, and refers to the
+ * buffer from which it was read, which must outlive the record.
+ * See section 4.2 of the SAM/BAM format specification.
+ */
+struct BAMRecord
+{
+    /** The binary record, excluding its block_size */
+    const char* data;
+    size_t length;
+
+    /** The names of the reference sequences */
+    const std::vector<std::string>* refNames;
+
+    /** The value of the BX:Z tag, found by parseTags */
+    StringSpan bx;
+
+    /** The type of the NM tag, found by parseTags, or NULL */
+    const char* nm;
+
+    BAMRecord() : data(NULL), length(0), refNames(NULL), nm(NULL) { }
+
+    int32_t refID() const { return getLittleEndian<int32_t>(data); }
+    unsigned lengthReadName() const { return (unsigned char)data[8]; }
+    unsigned numCigarOps() const { return getLittleEndian<uint16_t>(data + 12); }
+    int32_t lengthSeq() const { return getLittleEndian<int32_t>(data + 16); }
+    int32_t nextRefID() const { return getLittleEndian<int32_t>(data + 20); }
+
+    /** Return the read name, which is empty for an empty record. */
+    StringSpan qname() const
+    {
+        if (data == NULL)
+            return StringSpan();
+        assert(lengthReadName() > 0);
+        return StringSpan(data + 32, lengthReadName() - 1);
+    }
+
+    int flag() const { return getLittleEndian<uint16_t>(data + 14); }
+    int mapq() const { return (unsigned char)data[9]; }
+
+    /** Return the 1-based position, or 0 if unmapped. */
+    int pos() const { return getLittleEndian<int32_t>(data + 4) + 1; }
+
+    /** Return the 1-based position of the mate, or 0 if unmapped. */
+    int pnext() const { return getLittleEndian<int32_t>(data + 24) + 1; }
+
+    /** Return the name of the reference sequence, or "*". */
+    StringSpan rname() const { return refName(refID()); }
+
+    /** Return the name of the reference sequence of the mate, or "*". */
+    StringSpan rnext() const { return refName(nextRefID()); }
+
+    /** Return the name of the reference sequence id, or "*". */
+    StringSpan refName(int32_t id) const
+    {
+        if (id < 0 || size_t(id) >= refNames->size())
+            return StringSpan("*", 1);
+        return StringSpan((*refNames)[id]);
+    }
+
+    /**
+     * Return the length of SEQ as it would be written in SAM format.
+     * An absent sequence is written as "*", which has length 1.
+     */
+    size_t seqLength() const
+    {
+        int32_t n = lengthSeq();
+        return n > 0 ? n : 1;
+    }
+
+    /** Return the number of query bases in M, I, = and X operations. */
+    int alignedQueryLength() const
+    {
+        const char* cigar = data + 32 + lengthReadName();
+        int qalen = 0;
+        for (unsigned i = 0; i < numCigarOps(); ++i) {
+            uint32_t op = getLittleEndian<uint32_t>(cigar + 4 * i);
+            qalen += (op >> 4) * BAM_CIGAR_QUERY_OP[op & 0xf];
+        }
+        return qalen;
+    }
+
+    /** Return the auxiliary data following QUAL. */
+    StringSpan aux() const
+    {
+        size_t offset = 32 + lengthReadName() + 4 * numCigarOps()
+            + (lengthSeq() + 1) / 2 + lengthSeq();
+        assert(offset <= length);
+        return StringSpan(data + offset, length - offset);
+    }
+
+    /**
+     * Find the specified tag in the auxiliary data.
+     * @return a pointer to the type of the tag, or NULL if not found
+     */
+    const char* findTag(const char* tag) const
+    {
+        StringSpan s = aux();
+        for (const char* p = firstTag(s); p != NULL; p = nextTag(p, s.end()))
+            if (p[0] == tag[0] && p[1] == tag[1])
+                return p + 2;
+        return NULL;
+    }
+
+    /** Find the BX and NM tags in a single pass over the tags. */
+    void parseTags()
+    {
+        const char* bxTag = NULL;
+        nm = NULL;
+        StringSpan s = aux();
+        for (const char* p = firstTag(s); p != NULL && (bxTag == NULL || nm == NULL);
+                p = nextTag(p, s.end())) {
+            if (p[0] == 'B' && p[1] == 'X' && bxTag == NULL)
+                bxTag = p + 2;
+            else if (p[0] == 'N' && p[1] == 'M' && nm == NULL)
+                nm = p + 2;
+        }
+        bx = stringValue(bxTag);
+    }
+
+    /** Return the first tag of the auxiliary data s, or NULL. */
+    static const char* firstTag(const StringSpan& s)
+    {
+        return s.length >= 3 ? s.begin() : NULL;
+    }
+
+    /**
+     * Return the tag following the tag at p, or NULL at the end of
+     * the auxiliary data, which ends at end.
+     */
+    static const char* nextTag(const char* p, const char* end)
+    {
+        char type = p[2];
+        p += 3;
+        switch (type) {
+          case 'A': case 'c': case 'C': p += 1; break;
+          case 's': case 'S': p += 2; break;
+          case 'i': case 'I': case 'f': p += 4; break;
+          case 'Z': case 'H':
+            p = static_cast<const char*>(memchr(p, '\0', end - p));
+            if (p == NULL)
+                return NULL;
+            ++p;
+            break;
+          case 'B': {
+            if (p + 5 > end)
+                return NULL;
+            char subtype = p[0];
+            size_t n = getLittleEndian<uint32_t>(p + 1);
+            size_t size = subtype == 'c' || subtype == 'C' ? 1
+                : subtype == 's' || subtype == 'S' ? 2 : 4;
+            p += 5 + n * size;
+            break;
+          }
+          default:
+            return NULL;
+        }
+        return p + 3 <= end ? p : NULL;
+    }
+
+    /** Return the value of a string tag, such as "BX". */
+    StringSpan stringTag(const char* tag) const
+    {
+        return stringValue(findTag(tag));
+    }
+
+    /** Return the value of an integer tag, such as "NM", or 0. */
+    long integerTag(const char* tag) const
+    {
+        return integerValue(findTag(tag));
+    }
+
+    /** Return the string value of the tag whose type is at p. */
+    StringSpan stringValue(const char* p) const
+    {
+        if (p == NULL || *p != 'Z')
+            return StringSpan();
+        ++p;
+        const char* end = static_cast<const char*>(
+                memchr(p, '\0', data + length - p));
+        return end == NULL ? StringSpan() : StringSpan(p, end - p);
+    }
+
+    /** Return the integer value of the tag whose type is at p, or 0. */
+    static long integerValue(const char* p)
+    {
+        if (p == NULL)
+            return 0;
+        switch (p[0]) {
+          case 'c': return (signed char)p[1];
+          case 'C': return (unsigned char)p[1];
+          case 's': return getLittleEndian<int16_t>(p + 1);
+          case 'S': return getLittleEndian<uint16_t>(p + 1);
+          case 'i': return getLittleEndian<int32_t>(p + 1);
+          case 'I': return getLittleEndian<uint32_t>(p + 1);
+        }
+        return 0;
+    }
+
+    /** Return the barcode of the BX:Z tag. */
+    const StringSpan& barcodeTag() const { return bx; }
+
+    /** Return the edit distance of the NM:i tag, or 0. */
+    int editDistance() const { return integerValue(nm); }
+};
+
+/** Read a BAM file. */
+class BAMReader
+{
+  public:
+    /** A reference sequence: (name, length) */
+    typedef std::pair<std::string, int> Reference;
+
+    /**
+     * Open the BAM file and read its header. Uncompress it using the
+     * specified number of threads.
+     */
+    explicit BAMReader(const std::string& path, unsigned threads = 1)
+        : m_path(path)
+    {
+        m_in.open(path, threads);
+        char magic[4];
+        if (m_in.read(magic, 4) != 4 || memcmp(magic, "BAM\1", 4) != 0)
+            die("not in BAM format");
+
+        // Skip the SAM header text. The binary header lists the
+        // reference sequences.
+        std::string text(readInt32(), '\0');
+        if (!text.empty() && m_in.read(&text[0], text.size()) != text.size())
+            die("truncated BAM header");
+
+        int32_t numRefs = readInt32();
+        m_refs.reserve(numRefs);
+        m_refNames.reserve(numRefs);
+        std::string name;
+        for (int32_t i = 0; i < numRefs; ++i) {
+            name.resize(readInt32());
+            if (name.empty() || m_in.read(&name[0], name.size()) != name.size())
+                die("truncated BAM header");
+            name.resize(name.size() - 1); // remove the NUL
+            m_refs.push_back(Reference(name, readInt32()));
+            m_refNames.push_back(name);
+        }
+    }
+
+    /** Return the reference sequences of the header. */
+    const std::vector<Reference>& references() const { return m_refs; }
+
+    /**
+     * Read the next alignment record into buffer, and point rec to it.
+     * @return false at the end of the file
+     */
+    bool read(std::string& buffer, BAMRecord& rec)
+    {
+        char sizeBytes[4];
+        size_t n = m_in.read(sizeBytes, 4);
+        if (n == 0)
+            return false;
+        if (n != 4)
+            die("truncated BAM record");
+        int32_t size = getLittleEndian<int32_t>(sizeBytes);
+        if (size < 33)
+            die("corrupt BAM record");
+        buffer.resize(size);
+        if (m_in.read(&buffer[0], size) != size_t(size))
+            die("truncated BAM record");
+        rec.data = buffer.data();
+        rec.length = size;
+        rec.refNames = &m_refNames;
+        if (rec.lengthReadName() == 0 || 32 + rec.lengthReadName() + 4 * rec.numCigarOps()
+                + (rec.lengthSeq() + 1) / 2 + rec.lengthSeq() > size_t(size))
+            die("corrupt BAM record");
+        rec.parseTags();
+        return true;
+    }
+
+  private:
+    void die(const char* message) const
+    {
+        std::cerr << "error: `" << m_path << "': " << message << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    int32_t readInt32()
+    {
+        char bytes[4];
+        if (m_in.read(bytes, 4) != 4)
+            die("truncated BAM header");
+        int32_t x = getLittleEndian<int32_t>(bytes);
+        if (x < 0)
+            die("corrupt BAM header");
+        return x;
+    }
+
+    std::string m_path;
+    BGZFReader m_in;
+    std::vector<Reference> m_refs;
+    std::vector<std::string> m_refNames;
+};
+
+#endif
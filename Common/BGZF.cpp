@@ -0,0 +1,271 @@
+/** Read files compressed with BGZF, the blocked gzip format of BAM.
+ * See section 4.1 of the SAM/BAM format specification.
+ */
+
+#include "BGZF.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+#include <zlib.h>
+
+using namespace std;
+
+/** The size of the fixed part of the gzip header */
+static const size_t GZIP_HEADER_SIZE = 12;
+
+/** The size of the gzip footer: CRC32 and ISIZE */
+static const size_t GZIP_FOOTER_SIZE = 8;
+
+/** Return the little-endian 16-bit integer at p. */
+static inline unsigned getU16(const char* p)
+{
+	const unsigned char* q = reinterpret_cast<const unsigned char*>(p);
+	return q[0] | q[1] << 8;
+}
+
+/** Return the little-endian 32-bit integer at p. */
+static inline uint32_t getU32(const char* p)
+{
+	const unsigned char* q = reinterpret_cast<const unsigned char*>(p);
+	return uint32_t(q[0]) | uint32_t(q[1]) << 8
+		| uint32_t(q[2]) << 16 | uint32_t(q[3]) << 24;
+}
+
+/** Print an error message and exit. */
+static void die(const string& path, const char* message)
+{
+	cerr << "error: `" << path << "': " << message << endl;
+	exit(EXIT_FAILURE);
+}
+
+void BGZFReader::open(const string& path, unsigned threads)
+{
+	assert(m_file == NULL);
+	m_path = path;
+	// Use the mode "rb" so that Uncompress.cpp does not open a pipe.
+	m_file = fopen(path.c_str(), "rb");
+	if (m_file == NULL) {
+		cerr << "error: `" << path << "': " << strerror(errno) << endl;
+		exit(EXIT_FAILURE);
+	}
+	m_block.clear();
+	m_pos = 0;
+	m_eof = false;
+
+	if (threads > 1) {
+		// Allow each thread a few blocks of read-ahead.
+		m_slots.assign(4 * threads, Slot());
+		m_nextRead = m_nextConsume = 0;
+		m_fileEOF = m_stop = false;
+		for (unsigned i = 0; i < threads; ++i)
+			m_threads.push_back(thread(&BGZFReader::worker, this));
+	}
+}
+
+void BGZFReader::close()
+{
+	if (!m_threads.empty()) {
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		for (auto& t : m_threads)
+			t.join();
+		m_threads.clear();
+		m_slots.clear();
+	}
+	if (m_file != NULL)
+		fclose(m_file);
+	m_file = NULL;
+}
+
+bool BGZFReader::isBGZF(const string& path)
+{
+	FILE* in = fopen(path.c_str(), "rb");
+	if (in == NULL)
+		return false;
+	char header[GZIP_HEADER_SIZE + 6];
+	size_t n = fread(header, 1, sizeof header, in);
+	fclose(in);
+	return n == sizeof header
+		&& (unsigned char)header[0] == 31
+		&& (unsigned char)header[1] == 139
+		&& header[2] == 8 && (header[3] & 4) != 0
+		&& getU16(&header[10]) >= 6
+		&& header[12] == 'B' && header[13] == 'C'
+		&& getU16(&header[14]) == 2;
+}
+
+bool BGZFReader::readRawBlock(FILE* in, const string& path,
+		vector<char>& raw)
+{
+	raw.resize(GZIP_HEADER_SIZE);
+	size_t n = fread(&raw[0], 1, GZIP_HEADER_SIZE, in);
+	if (n == 0 && feof(in))
+		return false;
+	if (n != GZIP_HEADER_SIZE)
+		die(path, "truncated BGZF block");
+	if ((unsigned char)raw[0] != 31 || (unsigned char)raw[1] != 139
+			|| raw[2] != 8 || (raw[3] & 4) == 0)
+		die(path, "not in BGZF format");
+
+	// Find the BC subfield, which stores the block size.
+	size_t xlen = getU16(&raw[10]);
+	raw.resize(GZIP_HEADER_SIZE + xlen);
+	if (fread(&raw[GZIP_HEADER_SIZE], 1, xlen, in) != xlen)
+		die(path, "truncated BGZF block");
+	size_t blockSize = 0;
+	for (size_t i = GZIP_HEADER_SIZE; i + 4 <= raw.size();) {
+		size_t slen = getU16(&raw[i + 2]);
+		if (raw[i] == 'B' && raw[i + 1] == 'C' && slen == 2)
+			blockSize = getU16(&raw[i + 4]) + 1;
+		i += 4 + slen;
+	}
+	if (blockSize < raw.size() + GZIP_FOOTER_SIZE)
+		die(path, "not in BGZF format");
+
+	size_t headerSize = raw.size();
+	raw.resize(blockSize);
+	if (fread(&raw[headerSize], 1, blockSize - headerSize, in)
+			!= blockSize - headerSize)
+		die(path, "truncated BGZF block");
+	return true;
+}
+
+void BGZFReader::inflateBlock(const vector<char>& raw,
+		const string& path, vector<char>& out)
+{
+	assert(raw.size() >= GZIP_HEADER_SIZE + GZIP_FOOTER_SIZE);
+	size_t headerSize = GZIP_HEADER_SIZE + getU16(&raw[10]);
+	const char* footer = &raw[raw.size() - GZIP_FOOTER_SIZE];
+	uint32_t crc = getU32(footer);
+	size_t isize = getU32(footer + 4);
+	if (isize > MAX_BLOCK_SIZE)
+		die(path, "corrupt BGZF block");
+	out.resize(isize);
+	if (isize == 0)
+		return;
+
+	z_stream zs;
+	memset(&zs, 0, sizeof zs);
+	if (inflateInit2(&zs, -15) != Z_OK)
+		die(path, "inflateInit2 failed");
+	zs.next_in = reinterpret_cast<Bytef*>(
+			const_cast<char*>(&raw[headerSize]));
+	zs.avail_in = raw.size() - headerSize - GZIP_FOOTER_SIZE;
+	zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	zs.avail_out = isize;
+	int status = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+	if (status != Z_STREAM_END || zs.avail_out != 0)
+		die(path, "corrupt BGZF block");
+	if (crc32(0, reinterpret_cast<const Bytef*>(&out[0]), isize) != crc)
+		die(path, "BGZF block CRC mismatch");
+}
+
+void BGZFReader::worker()
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;) {
+		m_cond.wait(lock, [this] {
+			return m_stop || (!m_fileEOF
+				&& m_nextRead < m_nextConsume + m_slots.size());
+		});
+		if (m_stop)
+			return;
+
+		// Read the blocks sequentially, and uncompress them in parallel.
+		Slot& slot = m_slots[m_nextRead++ % m_slots.size()];
+		if (!readRawBlock(m_file, m_path, slot.raw)) {
+			m_fileEOF = true;
+			slot.last = true;
+			slot.ready = true;
+			m_cond.notify_all();
+			continue;
+		}
+		lock.unlock();
+		inflateBlock(slot.raw, m_path, slot.data);
+		lock.lock();
+		slot.ready = true;
+		m_cond.notify_all();
+	}
+}
+
+bool BGZFReader::nextBlockParallel()
+{
+	unique_lock<mutex> lock(m_mutex);
+	for (;;) {
+		Slot& slot = m_slots[m_nextConsume % m_slots.size()];
+		m_cond.wait(lock, [&slot] { return slot.ready; });
+		if (slot.last)
+			return false;
+		m_block.swap(slot.data);
+		slot.ready = false;
+		++m_nextConsume;
+		m_cond.notify_all();
+		if (!m_block.empty())
+			return true;
+	}
+}
+
+bool BGZFReader::nextBlock()
+{
+	assert(m_file != NULL);
+	m_pos = 0;
+	if (!m_threads.empty()) {
+		if (nextBlockParallel())
+			return true;
+	} else {
+		while (readRawBlock(m_file, m_path, m_raw)) {
+			inflateBlock(m_raw, m_path, m_block);
+			if (!m_block.empty())
+				return true;
+		}
+	}
+	m_eof = true;
+	m_block.clear();
+	return false;
+}
+
+size_t BGZFReader::read(void* dst, size_t n)
+{
+	char* out = static_cast<char*>(dst);
+	size_t count = 0;
+	while (count < n) {
+		if (m_pos == m_block.size() && (m_eof || !nextBlock()))
+			break;
+		size_t k = min(n - count, m_block.size() - m_pos);
+		memcpy(out + count, &m_block[m_pos], k);
+		m_pos += k;
+		count += k;
+	}
+	return count;
+}
+
+bool BGZFReader::getline(string& line)
+{
+	line.clear();
+	for (;;) {
+		if (m_pos == m_block.size() && (m_eof || !nextBlock()))
+			return !line.empty();
+		const char* p = &m_block[m_pos];
+		size_t n = m_block.size() - m_pos;
+		const char* nl = static_cast<const char*>(memchr(p, '\n', n));
+		if (nl != NULL) {
+			line.append(p, nl - p);
+			m_pos += nl - p + 1;
+			return true;
+		}
+		line.append(p, n);
+		m_pos += n;
+	}
+}
+
+bool BGZFReader::eof()
+{
+	return m_pos == m_block.size() && (m_eof || !nextBlock());
+}
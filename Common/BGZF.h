@@ -0,0 +1,111 @@
+#ifndef BGZF_H
+#define BGZF_H 1
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Read a file compressed with BGZF, the blocked gzip format used by
+ * BAM and bgzip. A BGZF file is a series of gzip members, each of
+ * which holds at most 64 kB of uncompressed data. Since the blocks
+ * are independent, they may be uncompressed in parallel by a pool of
+ * threads, and are returned in their original order.
+ */
+class BGZFReader
+{
+  public:
+	BGZFReader() : m_file(NULL), m_pos(0), m_eof(false),
+		m_nextRead(0), m_nextConsume(0), m_fileEOF(false), m_stop(false)
+	{ }
+	~BGZFReader() { close(); }
+
+	/** Open the specified file, and uncompress it using the
+	 * specified number of threads. Exit if it cannot be opened.
+	 */
+	void open(const std::string& path, unsigned threads = 1);
+
+	/** Close the file. */
+	void close();
+
+	/** Read up to n bytes.
+	 * @return the number of bytes read, which is less than n only
+	 * at the end of the file
+	 */
+	size_t read(void* dst, size_t n);
+
+	/** Read a line, excluding its newline, into line.
+	 * @return false at the end of the file
+	 */
+	bool getline(std::string& line);
+
+	/** Return whether the end of the file has been reached. */
+	bool eof();
+
+	/** The maximum size of a BGZF block */
+	static const size_t MAX_BLOCK_SIZE = 65536;
+
+	/** Return whether the specified file is compressed with BGZF. */
+	static bool isBGZF(const std::string& path);
+
+	/** Read the next compressed block from in into raw.
+	 * @return false at the end of the file
+	 */
+	static bool readRawBlock(FILE* in, const std::string& path,
+			std::vector<char>& raw);
+
+	/** Uncompress a block read by readRawBlock into out. */
+	static void inflateBlock(const std::vector<char>& raw,
+			const std::string& path, std::vector<char>& out);
+
+  private:
+	BGZFReader(const BGZFReader&);
+	BGZFReader& operator=(const BGZFReader&);
+
+	/** Read and uncompress the next non-empty block.
+	 * @return false at the end of the file
+	 */
+	bool nextBlock();
+
+	/** Return the next uncompressed block of the thread pool.
+	 * @return false at the end of the file
+	 */
+	bool nextBlockParallel();
+
+	/** Read and uncompress blocks. Run by each thread of the pool. */
+	void worker();
+
+	std::string m_path;
+	FILE* m_file;
+	std::vector<char> m_raw;
+	std::vector<char> m_block;
+	size_t m_pos;
+	bool m_eof;
+
+	/** A block in the queue of the thread pool */
+	struct Slot {
+		std::vector<char> raw;
+		std::vector<char> data;
+		bool ready;
+		bool last;
+		Slot() : ready(false), last(false) { }
+	};
+
+	/** The thread pool, which is empty when using a single thread */
+	std::vector<std::thread> m_threads;
+	/** A circular queue of blocks, indexed by block number */
+	std::vector<Slot> m_slots;
+	/** The number of the next block to read from the file */
+	size_t m_nextRead;
+	/** The number of the next block to return to the reader */
+	size_t m_nextConsume;
+	bool m_fileEOF;
+	bool m_stop;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+};
+
+#endif
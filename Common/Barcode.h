@@ -0,0 +1,128 @@
+#ifndef BARCODE_H
+#define BARCODE_H 1
+
+#include "Common/StringUtil.h"
+#include <cassert>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A barcode, packed into an integer. Zero is the empty barcode.
+ * A barcode of at most 27 nucleotides, all upper case or all lower
+ * case, optionally followed by a suffix "-1" to "-7", is packed as
+ * - bits 0 to 53: the nucleotides, two bits each, the first lowest
+ * - bits 54 to 58: the number of nucleotides
+ * - bit 59: set if the nucleotides are lower case
+ * - bits 60 to 62: the digit of the suffix, or 0 if none
+ * - bit 63: clear
+ * Any other barcode is stored in a table of the BarcodeCodec, and
+ * its ID is its index in that table with bit 63 set.
+ */
+typedef uint64_t BarcodeID;
+
+/** Convert barcodes to packed integers and back. */
+class BarcodeCodec
+{
+  public:
+	static const unsigned MAX_PACKED_LENGTH = 27;
+
+	BarcodeCodec() { }
+
+	/**
+	 * Return the ID of the barcode s. This function may be called
+	 * by several threads concurrently.
+	 */
+	BarcodeID encode(const StringSpan& s)
+	{
+		BarcodeID id;
+		if (pack(s, id))
+			return id;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::pair<Map::iterator, bool> inserted = m_map.insert(
+				Map::value_type(s.str(), FALLBACK | m_vec.size()));
+		if (inserted.second)
+			m_vec.push_back(inserted.first->first);
+		return inserted.first->second;
+	}
+
+	/** Return the barcode whose ID is id. */
+	std::string decode(BarcodeID id) const
+	{
+		if (id & FALLBACK) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			assert((id & ~FALLBACK) < m_vec.size());
+			return m_vec[id & ~FALLBACK];
+		}
+		unsigned length = (id >> LENGTH_SHIFT) & 0x1f;
+		const char* bases = id & LOWER_CASE ? "acgt" : "ACGT";
+		std::string s(length, '\0');
+		for (unsigned i = 0; i < length; ++i)
+			s[i] = bases[(id >> 2 * i) & 3];
+		unsigned suffix = (id >> SUFFIX_SHIFT) & 7;
+		if (suffix != 0) {
+			s += '-';
+			s += char('0' + suffix);
+		}
+		return s;
+	}
+
+	/** Return the number of barcodes stored in the table. */
+	size_t fallbackSize() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_vec.size();
+	}
+
+	/**
+	 * Pack the barcode s into id.
+	 * @return false if s cannot be packed
+	 */
+	static bool pack(const StringSpan& s, BarcodeID& id)
+	{
+		size_t length = s.length;
+		unsigned suffix = 0;
+		if (length >= 2 && s[length - 2] == '-') {
+			suffix = unsigned(s[length - 1] - '0');
+			if (suffix == 0 || suffix > 7)
+				return false;
+			length -= 2;
+		}
+		if (length > MAX_PACKED_LENGTH)
+			return false;
+
+		id = BarcodeID(suffix) << SUFFIX_SHIFT
+			| BarcodeID(length) << LENGTH_SHIFT;
+		if (length > 0 && s[0] >= 'a')
+			id |= LOWER_CASE;
+		const char* bases = id & LOWER_CASE ? "acgt" : "ACGT";
+		for (size_t i = 0; i < length; ++i) {
+			char c = s[i];
+			unsigned x = c == bases[0] ? 0 : c == bases[1] ? 1
+				: c == bases[2] ? 2 : c == bases[3] ? 3 : 4;
+			if (x == 4)
+				return false;
+			id |= BarcodeID(x) << 2 * i;
+		}
+		return true;
+	}
+
+  private:
+	BarcodeCodec(const BarcodeCodec&);
+	BarcodeCodec& operator=(const BarcodeCodec&);
+
+	static const BarcodeID FALLBACK = BarcodeID(1) << 63;
+	static const unsigned SUFFIX_SHIFT = 60;
+	static const BarcodeID LOWER_CASE = BarcodeID(1) << 59;
+	static const unsigned LENGTH_SHIFT = 54;
+
+	typedef std::unordered_map<std::string, BarcodeID> Map;
+
+	mutable std::mutex m_mutex;
+	Map m_map;
+	std::vector<std::string> m_vec;
+};
+
+#endif
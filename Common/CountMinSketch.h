@@ -0,0 +1,112 @@
+#ifndef COUNTMINSKETCH_H
+#define COUNTMINSKETCH_H 1
+
+#include "Common/HashFunction.h"
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * A count-min sketch of small saturating counters, which estimates the
+ * number of occurrences of each key in a fixed amount of memory.
+ * Like a Bloom filter, each key is hashed to one counter in each of
+ * DEPTH rows of counters, and its estimate is the minimum of those
+ * counters. The conservative update increments only the counters
+ * that equal that minimum.
+ *
+ * The estimate of a key is never less than its number of
+ * occurrences, up to the limit at which the counters saturate. With
+ * w counters per row and N occurrences of all keys, the estimate
+ * exceeds the number of occurrences by more than e N / w with
+ * probability at most e^-DEPTH.
+ */
+class CountMinSketch
+{
+  public:
+	static const unsigned DEPTH = 4;
+	static const unsigned MAX_LIMIT = 255;
+
+	CountMinSketch() : m_width(0), m_limit(0) { }
+
+	/**
+	 * Allocate a sketch of about bytes bytes, whose counters
+	 * saturate at limit. Zero bytes disables the sketch.
+	 */
+	void init(size_t bytes, unsigned limit)
+	{
+		assert(limit > 0 && limit <= MAX_LIMIT);
+		m_width = bytes / DEPTH;
+		m_limit = limit;
+		std::vector<uint8_t>(m_width * DEPTH).swap(m_counters);
+	}
+
+	/** Return whether the sketch is enabled. */
+	bool enabled() const { return m_width > 0; }
+
+	/** Return the limit at which the counters saturate. */
+	unsigned limit() const { return m_limit; }
+
+	/**
+	 * Add an occurrence of key, and return its estimate before it
+	 * was added. The estimate does not exceed the limit. This
+	 * function may be called by several threads concurrently.
+	 */
+	unsigned increment(uint64_t key)
+	{
+		uint8_t* counters[DEPTH];
+		for (unsigned i = 0; i < DEPTH; ++i)
+			counters[i] = &m_counters[i * m_width
+				+ hashmem(&key, sizeof key, i) % m_width];
+
+		// The counters of other keys only increase, so that
+		// locking the key suffices to count each of its
+		// occurrences once.
+		std::lock_guard<std::mutex> lock(
+				m_mutexes[hashmem(&key, sizeof key) % NUM_MUTEXES]);
+		unsigned estimate = m_limit;
+		for (unsigned i = 0; i < DEPTH; ++i)
+			estimate = std::min<unsigned>(estimate,
+					__atomic_load_n(counters[i], __ATOMIC_RELAXED));
+		if (estimate < m_limit)
+			for (unsigned i = 0; i < DEPTH; ++i)
+				raise(counters[i], estimate + 1);
+		return estimate;
+	}
+
+	/** Return the estimate of key. */
+	unsigned count(uint64_t key) const
+	{
+		unsigned estimate = m_limit;
+		for (unsigned i = 0; i < DEPTH; ++i)
+			estimate = std::min<unsigned>(estimate, __atomic_load_n(
+						&m_counters[i * m_width
+						+ hashmem(&key, sizeof key, i) % m_width],
+						__ATOMIC_RELAXED));
+		return estimate;
+	}
+
+  private:
+	CountMinSketch(const CountMinSketch&);
+	CountMinSketch& operator=(const CountMinSketch&);
+
+	static const unsigned NUM_MUTEXES = 64;
+
+	/* Raise the counter *p to at least x. */
+	static void raise(uint8_t* p, unsigned x)
+	{
+		uint8_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+		while (old < x && !__atomic_compare_exchange_n(p, &old,
+					uint8_t(x), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+
+	size_t m_width;
+	unsigned m_limit;
+	std::vector<uint8_t> m_counters;
+	std::mutex m_mutexes[NUM_MUTEXES];
+};
+
+#endif
@@ -68,6 +68,18 @@ class Dictionary
 			return it->second;
 		}
 
+		/** Find the index of the specified name.
+		 * @return false if the name is not in this dictionary
+		 */
+		bool find(cstring name, index_type& index) const
+		{
+			Map::const_iterator it = m_map.find(name);
+			if (it == m_map.end())
+				return false;
+			index = it->second;
+			return true;
+		}
+
 		/** Return the name of the specified index. */
 		name_reference getName(index_type index) const
 		{
@@ -81,6 +93,13 @@ class Dictionary
 		/** Unlock this dictionary. */
 		void unlock() { m_locked = false; }
 
+		/** Reserve memory for n elements. */
+		void reserve(size_t n)
+		{
+			m_map.reserve(n);
+			m_vec.reserve(n);
+		}
+
 		/** Return true if this dictionary is empty. */
 		bool empty() const { return m_vec.empty(); }
 
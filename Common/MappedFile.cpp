@@ -0,0 +1,65 @@
+/** Map regular files into memory. */
+
+#include "MappedFile.h"
+#include <algorithm>
+#include <cassert>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool MappedFile::open(const string& path)
+{
+	assert(m_data == NULL);
+	int fd = ::open(path.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		::close(fd);
+		return false;
+	}
+
+	m_size = st.st_size;
+	if (m_size == 0) {
+		// An empty file cannot be mapped, and has no data.
+		::close(fd);
+		return true;
+	}
+
+	void* p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		m_size = 0;
+		return false;
+	}
+	m_data = static_cast<const char*>(p);
+	madvise(p, m_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	// Ask for transparent huge pages to reduce TLB misses. The kernel
+	// may not support them for this file, which is not an error.
+	madvise(p, m_size, MADV_HUGEPAGE);
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data != NULL)
+		munmap(const_cast<char*>(m_data), m_size);
+	m_data = NULL;
+	m_size = 0;
+}
+
+void MappedFile::willNeed(size_t offset, size_t length) const
+{
+	if (m_data == NULL || offset >= m_size)
+		return;
+	// madvise requires an address aligned to a page.
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t start = offset / pageSize * pageSize;
+	length = min(length, m_size - offset) + (offset - start);
+	madvise(const_cast<char*>(m_data) + start, length, MADV_WILLNEED);
+}
@@ -0,0 +1,46 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H 1
+
+#include <cstddef>
+#include <string>
+
+/**
+ * A read-only memory mapping of a regular file. The pages of the file
+ * are read by the kernel as they are accessed, without copying them
+ * into a buffer of the process.
+ */
+class MappedFile
+{
+  public:
+	MappedFile() : m_data(NULL), m_size(0) { }
+	~MappedFile() { close(); }
+
+	/** Map the specified file and advise the kernel that it will be
+	 * read sequentially.
+	 * @return false if the file is not a regular file, such as a pipe
+	 * or /dev/stdin, or cannot be mapped, in which case it should be
+	 * read as a stream
+	 */
+	bool open(const std::string& path);
+
+	/** Unmap the file. */
+	void close();
+
+	/** Return the contents of the file. */
+	const char* data() const { return m_data; }
+
+	/** Return the size of the file. */
+	size_t size() const { return m_size; }
+
+	/** Advise the kernel that the specified range will be needed soon. */
+	void willNeed(size_t offset, size_t length) const;
+
+  private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* m_data;
+	size_t m_size;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef POOLALLOCATOR_H
+#define POOLALLOCATOR_H 1
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * The chunks of memory of the node pools of Tag, which are freed
+ * together. The pools of different tags are released independently.
+ */
+template <typename Tag = void>
+class PoolArena
+{
+  public:
+	/** Allocate a chunk of size bytes. */
+	static char* allocateChunk(size_t size)
+	{
+		char* p = static_cast<char*>(::operator new(size));
+		std::lock_guard<std::mutex> lock(mutex());
+		chunks().push_back(p);
+		return p;
+	}
+
+	/**
+	 * Free the memory of all the pools of Tag. No node may remain
+	 * allocated. The pools of every thread are emptied.
+	 */
+	static void release()
+	{
+		std::lock_guard<std::mutex> lock(mutex());
+		for (char* p : chunks())
+			::operator delete(p);
+		std::vector<char*>().swap(chunks());
+		++generation();
+	}
+
+	/** The number of times that the memory has been released */
+	static std::atomic<unsigned>& generation()
+	{
+		static std::atomic<unsigned> s_generation(0);
+		return s_generation;
+	}
+
+  private:
+	static std::mutex& mutex()
+	{
+		static std::mutex s_mutex;
+		return s_mutex;
+	}
+
+	static std::vector<char*>& chunks()
+	{
+		static std::vector<char*> s_chunks;
+		return s_chunks;
+	}
+};
+
+/**
+ * A pool of nodes of Size bytes. Each thread allocates nodes from its
+ * own chunk of memory and reuses the nodes that it frees, so that
+ * allocation needs no lock and no header per node. A thread that
+ * frees more nodes than it allocates, such as one that merges the
+ * maps of other threads, returns them in batches to a shared list,
+ * from which the other threads take them before allocating a chunk,
+ * so that the pool is as large as the nodes in use at once.
+ */
+template <size_t Size, typename Tag = void>
+class NodePool
+{
+  public:
+	static const size_t ALIGNMENT = 16;
+
+	static void* allocate()
+	{
+		Cache& c = cache();
+		if (c.free == NULL)
+			c.takeBatch();
+		if (c.free != NULL) {
+			Node* p = c.free;
+			c.free = p->next;
+			--c.count;
+			return p;
+		}
+		if (c.next == c.end) {
+			c.next = PoolArena<Tag>::allocateChunk(CHUNK_SIZE);
+			c.end = c.next + CHUNK_SIZE / NODE_SIZE * NODE_SIZE;
+		}
+		void* p = c.next;
+		c.next += NODE_SIZE;
+		return p;
+	}
+
+	static void deallocate(void* p)
+	{
+		Cache& c = cache();
+		Node* node = static_cast<Node*>(p);
+		node->next = c.free;
+		c.free = node;
+		if (++c.count >= 2 * BATCH_SIZE)
+			c.returnBatch(BATCH_SIZE);
+	}
+
+  private:
+	struct Node { Node* next; };
+
+	static const size_t NODE_SIZE = ((Size > sizeof (Node) ? Size : sizeof (Node))
+		+ ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	static const size_t CHUNK_SIZE = 1 << 20;
+
+	/* The number of free nodes moved to and from the shared list at once */
+	static const size_t BATCH_SIZE = 1024;
+
+	/* The batches of free nodes shared by the threads */
+	struct Shared {
+		std::mutex mutex;
+		std::vector<std::pair<Node*, size_t> > batches;
+		unsigned generation;
+
+		/* Drop the batches of memory that has been released. */
+		void update()
+		{
+			unsigned current = PoolArena<Tag>::generation();
+			if (generation != current) {
+				batches.clear();
+				generation = current;
+			}
+		}
+	};
+
+	static Shared& shared()
+	{
+		static Shared s_shared;
+		return s_shared;
+	}
+
+	/* The free nodes and unused memory of a thread */
+	struct Cache {
+		Node* free;
+		size_t count;
+		char* next;
+		char* end;
+		unsigned generation;
+
+		/* Take a batch of free nodes from the shared list. */
+		void takeBatch()
+		{
+			Shared& s = shared();
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.update();
+			if (s.batches.empty())
+				return;
+			free = s.batches.back().first;
+			count = s.batches.back().second;
+			s.batches.pop_back();
+		}
+
+		/* Move n free nodes to the shared list. */
+		void returnBatch(size_t n)
+		{
+			Node* first = free;
+			Node* last = free;
+			for (size_t i = 1; i < n; ++i)
+				last = last->next;
+			free = last->next;
+			count -= n;
+			last->next = NULL;
+			Shared& s = shared();
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.update();
+			s.batches.push_back(std::make_pair(first, n));
+		}
+
+		/* Return the free nodes of a thread when it exits. */
+		~Cache()
+		{
+			if (count > 0 && generation == PoolArena<Tag>::generation())
+				returnBatch(count);
+		}
+	};
+
+	static Cache& cache()
+	{
+		static thread_local Cache c = { NULL, 0, NULL, NULL, 0 };
+		unsigned generation = PoolArena<Tag>::generation();
+		if (c.generation != generation) {
+			c.free = NULL;
+			c.count = 0;
+			c.next = c.end = NULL;
+			c.generation = generation;
+		}
+		return c;
+	}
+};
+
+/**
+ * An allocator of single objects from a NodePool of Tag, for the
+ * nodes of node-based containers. Arrays are allocated by operator new.
+ */
+template <typename T, typename Tag = void>
+class PoolAllocator
+{
+  public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template <typename U>
+	struct rebind { typedef PoolAllocator<U, Tag> other; };
+
+	PoolAllocator() { }
+
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U, Tag>&) { }
+
+	T* allocate(size_t n)
+	{
+		static_assert(alignof(T) <= NodePool<sizeof (T), Tag>::ALIGNMENT,
+				"alignment of T");
+		if (n != 1)
+			return static_cast<T*>(::operator new(n * sizeof (T)));
+		return static_cast<T*>(NodePool<sizeof (T), Tag>::allocate());
+	}
+
+	void deallocate(T* p, size_t n)
+	{
+		if (n != 1)
+			::operator delete(p);
+		else
+			NodePool<sizeof (T), Tag>::deallocate(p);
+	}
+};
+
+template <typename T, typename U, typename Tag>
+bool operator==(const PoolAllocator<T, Tag>&, const PoolAllocator<U, Tag>&)
+{
+	return true;
+}
+
+template <typename T, typename U, typename Tag>
+bool operator!=(const PoolAllocator<T, Tag>&, const PoolAllocator<U, Tag>&)
+{
+	return false;
+}
+
+#endif
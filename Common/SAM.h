@@ -1,6 +1,10 @@
 #ifndef SAM_H
 #define SAM_H 1
 
+#include "Common/StringUtil.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <string>
 
 /** Extract the specified SAM tag from a string.
@@ -32,4 +36,177 @@ static inline std::string parseBXTag(const std::string& s)
     return parseSAMTag(s, "BX:Z:");
 }
 
+/** Find the specified SAM tag in a span of SAM tags without copying.
+ * @param tag the SAM tag, including two colons, for example "BX:Z:"
+ * @return the value of the tag, or an empty span if not found
+ */
+template <size_t N>
+static inline StringSpan findSAMTag(const StringSpan& s, const char (&tag)[N])
+{
+    const char* start = std::search(s.begin(), s.end(), tag, tag + N - 1);
+    if (start == s.end())
+        return StringSpan();
+    start += N - 1;
+
+    // Find the next whitespace or EOL after the tag.
+    const char* end = start;
+    while (end != s.end() && *end != ' ' && *end != '\t'
+            && *end != '\r' && *end != '\n')
+        ++end;
+    return StringSpan(start, end - start);
+}
+
+/** Return 1 for a CIGAR operation that is aligned and consumes the
+ * query (M, I, = and X), and 0 otherwise.
+ */
+static constexpr unsigned char cigarQueryOp(unsigned c)
+{
+    return c == 'M' || c == 'I' || c == '=' || c == 'X';
+}
+
+#define CIGAR_QUERY_OP4(c) cigarQueryOp(c), cigarQueryOp(c + 1), \
+    cigarQueryOp(c + 2), cigarQueryOp(c + 3)
+#define CIGAR_QUERY_OP16(c) CIGAR_QUERY_OP4(c), CIGAR_QUERY_OP4(c + 4), \
+    CIGAR_QUERY_OP4(c + 8), CIGAR_QUERY_OP4(c + 12)
+#define CIGAR_QUERY_OP64(c) CIGAR_QUERY_OP16(c), CIGAR_QUERY_OP16(c + 16), \
+    CIGAR_QUERY_OP16(c + 32), CIGAR_QUERY_OP16(c + 48)
+
+/** cigarQueryOp of each character */
+static constexpr unsigned char CIGAR_QUERY_OP[256] = {
+    CIGAR_QUERY_OP64(0), CIGAR_QUERY_OP64(64),
+    CIGAR_QUERY_OP64(128), CIGAR_QUERY_OP64(192)
+};
+
+#undef CIGAR_QUERY_OP4
+#undef CIGAR_QUERY_OP16
+#undef CIGAR_QUERY_OP64
+
+/** Return the number of query bases in the M, I, = and X operations
+ * of a CIGAR string.
+ */
+static inline int cigarAlignedQueryLength(const char* p, const char* end)
+{
+    int qalen = 0;
+    unsigned n = 0;
+    for (; p != end; ++p) {
+        unsigned digit = (unsigned char)*p - '0';
+        if (digit < 10) {
+            n = 10 * n + digit;
+        } else {
+            qalen += n * CIGAR_QUERY_OP[(unsigned char)*p];
+            n = 0;
+        }
+    }
+    return qalen;
+}
+
+/**
+ * A SAM alignment record split into its fields without copying.
+ * Each field refers to the line from which it was parsed, which must
+ * outlive the record. Numeric fields are parsed only when requested.
+ */
+struct SAMRecord
+{
+    enum Field { QNAME, FLAG, RNAME, POS, MAPQ, CIGAR,
+        RNEXT, PNEXT, TLEN, SEQ, QUAL, NUM_FIELDS };
+
+    /** The mandatory fields */
+    StringSpan fields[NUM_FIELDS];
+
+    /** The optional fields (tags) following QUAL */
+    StringSpan tags;
+
+    /** The values of the BX:Z and NM:i tags, found by parse */
+    StringSpan bx, nm;
+
+    /** Split a line into fields. Missing fields are left empty.
+     * @return whether all mandatory fields were present
+     */
+    bool parse(const char* p, const char* end)
+    {
+        for (unsigned i = 0; i < NUM_FIELDS; ++i) {
+            const char* tab = static_cast<const char*>(
+                    memchr(p, '\t', end - p));
+            const char* fieldEnd = tab != NULL ? tab : end;
+            fields[i] = StringSpan(p, fieldEnd - p);
+            if (tab == NULL) {
+                bool complete = i == QUAL;
+                for (++i; i < NUM_FIELDS; ++i)
+                    fields[i] = StringSpan();
+                tags = bx = nm = StringSpan();
+                return complete;
+            }
+            p = tab + 1;
+        }
+        tags = StringSpan(p, end - p);
+        parseTags();
+        return true;
+    }
+
+    /** Find the BX:Z and NM:i tags in a single pass over the tags. */
+    void parseTags()
+    {
+        bx = nm = StringSpan();
+        for (const char* p = tags.begin(); p < tags.end();) {
+            const char* tab = static_cast<const char*>(
+                    memchr(p, '\t', tags.end() - p));
+            const char* tagEnd = tab != NULL ? tab : tags.end();
+            if (tagEnd - p >= 5 && p[2] == ':' && p[4] == ':') {
+                StringSpan* value
+                    = p[0] == 'B' && p[1] == 'X' && p[3] == 'Z' ? &bx
+                    : p[0] == 'N' && p[1] == 'M' && p[3] == 'i' ? &nm
+                    : NULL;
+                if (value != NULL && value->data == NULL) {
+                    // The value ends at whitespace.
+                    const char* q = p + 5;
+                    while (q != tagEnd && *q != ' ' && *q != '\r' && *q != '\n')
+                        ++q;
+                    *value = StringSpan(p + 5, q - (p + 5));
+                }
+            }
+            p = tagEnd + 1;
+        }
+    }
+
+    bool parse(const std::string& line)
+    {
+        return parse(line.data(), line.data() + line.size());
+    }
+
+    const StringSpan& qname() const { return fields[QNAME]; }
+    const StringSpan& rname() const { return fields[RNAME]; }
+    const StringSpan& cigar() const { return fields[CIGAR]; }
+    const StringSpan& seq() const { return fields[SEQ]; }
+
+    /** Return the reference of the mate, which may be "=". */
+    const StringSpan& rnext() const { return fields[RNEXT]; }
+
+    int flag() const { return parseInteger(fields[FLAG]); }
+    int pos() const { return parseInteger(fields[POS]); }
+    int mapq() const { return parseInteger(fields[MAPQ]); }
+    int pnext() const { return parseInteger(fields[PNEXT]); }
+
+    /** Return the length of SEQ. */
+    size_t seqLength() const { return fields[SEQ].length; }
+
+    /** Return the number of query bases in M, I, = and X operations. */
+    int alignedQueryLength() const
+    {
+        return cigarAlignedQueryLength(cigar().begin(), cigar().end());
+    }
+
+    /** Return the value of the specified tag, such as "BX:Z:". */
+    template <size_t N>
+    StringSpan tag(const char (&name)[N]) const
+    {
+        return findSAMTag(tags, name);
+    }
+
+    /** Return the barcode of the BX:Z tag. */
+    const StringSpan& barcodeTag() const { return bx; }
+
+    /** Return the edit distance of the NM:i tag, or 0. */
+    int editDistance() const { return nm.empty() ? 0 : parseInteger(nm); }
+};
+
 #endif
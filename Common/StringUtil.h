@@ -2,6 +2,7 @@
 #define STRINGUTIL_H 1
 
 #include <cassert>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 #include <string>
@@ -87,4 +88,72 @@ bool endsWith(const std::string& s, const std::string& suffix)
 			suffix.begin());
 }
 
+/** A read-only view of a range of characters owned by some other
+ * buffer. It does not allocate and is invalidated when the buffer is
+ * modified.
+ */
+struct StringSpan
+{
+	const char* data;
+	size_t length;
+
+	StringSpan() : data(NULL), length(0) { }
+	StringSpan(const char* data, size_t length)
+		: data(data), length(length) { }
+	StringSpan(const std::string& s) : data(s.data()), length(s.size()) { }
+
+	bool empty() const { return length == 0; }
+	size_t size() const { return length; }
+	const char* begin() const { return data; }
+	const char* end() const { return data + length; }
+	char operator[](size_t i) const { return data[i]; }
+
+	/** Return a copy of this span as a string. */
+	std::string str() const { return std::string(data, length); }
+
+	bool operator==(const StringSpan& o) const
+	{
+		return length == o.length
+			&& (data == o.data || memcmp(data, o.data, length) == 0);
+	}
+
+	bool operator!=(const StringSpan& o) const { return !(*this == o); }
+
+	/** Compare to a string literal. */
+	template <size_t N>
+	bool operator==(const char (&s)[N]) const
+	{
+		return length == N - 1 && memcmp(data, s, N - 1) == 0;
+	}
+
+	template <size_t N>
+	bool operator!=(const char (&s)[N]) const { return !(*this == s); }
+
+	friend std::ostream& operator<<(std::ostream& out,
+			const StringSpan& o)
+	{
+		return out.write(o.data, o.length);
+	}
+};
+
+/** Parse a decimal integer, which may be negative. Parsing stops at
+ * the first character that is not a digit.
+ */
+static inline long parseInteger(const char* p, const char* end)
+{
+	bool negative = p != end && *p == '-';
+	if (negative)
+		++p;
+	long n = 0;
+	for (; p != end && unsigned(*p - '0') < 10; ++p)
+		n = 10 * n + (*p - '0');
+	return negative ? -n : n;
+}
+
+/** Parse a decimal integer, which may be negative. */
+static inline long parseInteger(const StringSpan& s)
+{
+	return parseInteger(s.begin(), s.end());
+}
+
 #endif
@@ -16,26 +16,41 @@ struct FAIRecord
 	size_t offset;
 	size_t size;
 	std::string id;
+	/** The number of bases and of bytes of each line but the last */
+	size_t lineLength, lineBytes;
 
-	FAIRecord() : offset(0), size(0) { }
+	FAIRecord() : offset(0), size(0), lineLength(0), lineBytes(1) { }
 	FAIRecord(size_t offset, size_t size, const std::string& id)
-		: offset(offset), size(size), id(id) { }
+		: offset(offset), size(size), id(id),
+		lineLength(size), lineBytes(size + 1) { }
+
+	/** Return the file offset of position pos of this sequence. */
+	size_t fileOffset(size_t pos) const
+	{
+		assert(pos < size);
+		return offset + pos / lineLength * lineBytes + pos % lineLength;
+	}
+
+	/** Return the file offset of the end of the last line. */
+	size_t endOffset() const
+	{
+		return size == 0 ? offset : fileOffset(size - 1) + 1;
+	}
 
 	friend std::ostream& operator<<(std::ostream& out,
 			const FAIRecord& o)
 	{
 		return out << o.id << '\t' << o.size << '\t' << o.offset
-			<< '\t' << o.size << '\t' << o.size + 1;
+			<< '\t' << o.lineLength << '\t' << o.lineBytes;
 	}
 
 	friend std::istream& operator>>(std::istream& in,
 			FAIRecord& o)
 	{
-		size_t lineLen, lineBinLen;
-		in >> o.id >> o.size >> o.offset >> lineLen >> lineBinLen;
+		in >> o.id >> o.size >> o.offset >> o.lineLength >> o.lineBytes;
 		if (!in)
 			return in;
-		assert(o.size == lineLen || lineLen == lineBinLen);
+		assert(o.lineLength < o.lineBytes);
 		return in >> Ignore('\n');
 	}
 };
@@ -64,30 +79,48 @@ class FastaIndex
 	size_t fileSize() const
 	{
 		assert(!m_data.empty());
-		return m_data.back().offset + m_data.back().size + 1;
+		const FAIRecord& rec = m_data.back();
+		return rec.endOffset() + rec.lineBytes - rec.lineLength;
 	}
 
 	typedef Data::const_iterator const_iterator;
 	const_iterator begin() const { return m_data.begin(); }
 	const_iterator end() const { return m_data.end(); }
 
-	/** Index the specified FASTA file. */
+	/**
+	 * Index the specified FASTA file, whose sequences may span
+	 * several lines, in one pass that reads one line at a time.
+	 */
 	void index(const std::string& path)
 	{
 		m_data.clear();
 		std::ifstream in(path.c_str());
 		assert_good(in, path);
-		char c;
-		for (std::string id;
-				in >> c && in >> id && in >> Ignore('\n');) {
-			assert(c == '>');
-			assert(!id.empty());
-			std::streampos offset = in.tellg();
-			assert(offset > 0);
-			in >> Ignore('\n');
-			size_t n = in.gcount();
-			assert(n > 0);
-			m_data.push_back(FAIRecord(offset, n - 1, id));
+		size_t offset = 0;
+		for (std::string line; getline(in, line);) {
+			size_t bytes = line.size() + !in.eof();
+			offset += bytes;
+			if (!line.empty() && line[0] == '>') {
+				size_t start = line.find_first_not_of(" \t", 1);
+				size_t end = line.find_first_of(" \t\r", start);
+				if (start == std::string::npos) {
+					std::cerr << "error: `" << path
+						<< "': missing sequence ID\n";
+					exit(EXIT_FAILURE);
+				}
+				m_data.push_back(FAIRecord(offset, 0,
+							line.substr(start, end - start)));
+				continue;
+			}
+			if (m_data.empty() || line.empty() || line[0] == '#')
+				continue;
+			size_t n = line.size() - (line[line.size() - 1] == '\r');
+			FAIRecord& rec = m_data.back();
+			if (rec.size == 0) {
+				rec.lineLength = n;
+				rec.lineBytes = bytes;
+			}
+			rec.size += n;
 		}
 		assert(in.eof());
 	}
@@ -102,8 +135,11 @@ class FastaIndex
 		--it;
 		assert(it != m_data.end());
 		assert(it->offset <= offset);
-		assert(offset < it->offset + it->size);
-		return SeqPos(*it, offset - it->offset);
+		size_t d = offset - it->offset;
+		assert(d % it->lineBytes < it->lineLength);
+		size_t pos = d / it->lineBytes * it->lineLength + d % it->lineBytes;
+		assert(pos < it->size);
+		return SeqPos(*it, pos);
 	}
 
 	/** Write FASTA headers to the specified seekable stream. */
@@ -119,7 +155,7 @@ class FastaIndex
 			if (!out.seekp(it->offset - 1))
 				break;
 			out << '\n';
-			if (!out.seekp(it->offset + it->size))
+			if (!out.seekp(it->endOffset()))
 				break;
 			out << '\n';
 		}
@@ -0,0 +1,79 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/BAM.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** Append a little-endian integer to a string. */
+template <typename T>
+static void put(string& s, T x)
+{
+    s.append(reinterpret_cast<const char*>(&x), sizeof x);
+}
+
+TEST_CASE("BAMRecord", "[BAM]")
+{
+    const string qname("read1");
+    const uint32_t cigar[] = { 50 << 4 | 0, 1 << 4 | 1, 10 << 4 | 4, 39 << 4 | 0 };
+
+    string data;
+    put<int32_t>(data, 1); // refID
+    put<int32_t>(data, 1000); // pos
+    put<uint8_t>(data, qname.size() + 1); // l_read_name
+    put<uint8_t>(data, 60); // mapq
+    put<uint16_t>(data, 0); // bin
+    put<uint16_t>(data, 4); // n_cigar_op
+    put<uint16_t>(data, 99); // flag
+    put<int32_t>(data, 3); // l_seq
+    put<int32_t>(data, 1); // next_refID
+    put<int32_t>(data, 1300); // next_pos
+    put<int32_t>(data, 400); // tlen
+    data.append(qname.c_str(), qname.size() + 1);
+    for (uint32_t op : cigar)
+        put<uint32_t>(data, op);
+    data += "\x12\x40"; // ACG
+    data += "\x1e\x1e\x1e"; // qual
+    data += "XAA";
+    data += 'x';
+    data += "XBBs";
+    put<uint32_t>(data, 2);
+    put<int16_t>(data, -1);
+    put<int16_t>(data, 1);
+    data += "BXZ";
+    data.append("CGTCAGGTCAGAGGTG-1", 19);
+    data += "NMC";
+    data += '\x05';
+
+    vector<string> refNames = { "contig0", "contig1" };
+    BAMRecord rec;
+    rec.data = data.data();
+    rec.length = data.size();
+    rec.refNames = &refNames;
+    rec.parseTags();
+
+    REQUIRE(rec.qname() == "read1");
+    REQUIRE(rec.flag() == 99);
+    REQUIRE(rec.rname() == "contig1");
+    REQUIRE(rec.pos() == 1001);
+    REQUIRE(rec.nextRefID() == 1);
+    REQUIRE(rec.rnext() == "contig1");
+    REQUIRE(rec.pnext() == 1301);
+    REQUIRE(rec.mapq() == 60);
+    REQUIRE(rec.seqLength() == 3);
+    REQUIRE(rec.alignedQueryLength() == 90);
+    REQUIRE(rec.barcodeTag() == "CGTCAGGTCAGAGGTG-1");
+    REQUIRE(rec.editDistance() == 5);
+    REQUIRE(rec.stringTag("XY").empty());
+
+    // An unmapped record
+    string unmapped(data);
+    unmapped.replace(0, 4, "\xff\xff\xff\xff", 4);
+    rec.data = unmapped.data();
+    REQUIRE(rec.rname() == "*");
+
+    // An empty record
+    REQUIRE(BAMRecord().qname().empty());
+}
@@ -0,0 +1,55 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/Barcode.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+TEST_CASE("pack", "[Barcode]")
+{
+    BarcodeID a, b, c;
+    REQUIRE(BarcodeCodec::pack(StringSpan(string("CGTCAGGTCAGAGGTG-1")), a));
+    REQUIRE(BarcodeCodec::pack(StringSpan(string("CGTCAGGTCAGAGGTG-2")), b));
+    REQUIRE(BarcodeCodec::pack(StringSpan(string("CGTCAGGTCAGAGGTG")), c));
+    REQUIRE(a != b);
+    REQUIRE(a != c);
+
+    // Barcodes that differ only in length are distinct.
+    REQUIRE(BarcodeCodec::pack(StringSpan(string("AAAA")), a));
+    REQUIRE(BarcodeCodec::pack(StringSpan(string("AAA")), b));
+    REQUIRE(a != b);
+
+    REQUIRE(BarcodeCodec::pack(StringSpan(), a));
+    REQUIRE(a == 0);
+
+    REQUIRE(!BarcodeCodec::pack(StringSpan(string("CGTNAGGT-1")), a));
+    REQUIRE(!BarcodeCodec::pack(StringSpan(string("CGTCAGGT-8")), a));
+    REQUIRE(!BarcodeCodec::pack(StringSpan(string("CGTCaggt")), a));
+    REQUIRE(!BarcodeCodec::pack(StringSpan(string(28, 'A')), a));
+}
+
+TEST_CASE("encode and decode", "[Barcode]")
+{
+    BarcodeCodec codec;
+    const char* barcodes[] = {
+        "CGTCAGGTCAGAGGTG-1", "cgtcaggtcagaggtg", "TTTTTTTTTTTTTTTTTTTTTTTTTTT-7",
+        "A", "-1", "CGTNAGGT-1", "BC_1234", "AACCGGTTAACCGGTTAACCGGTTAACCG" };
+    vector<BarcodeID> ids;
+    for (const char* s : barcodes) {
+        BarcodeID id = codec.encode(StringSpan(s, strlen(s)));
+        REQUIRE(id != 0);
+        REQUIRE(codec.decode(id) == s);
+        ids.push_back(id);
+    }
+    REQUIRE(codec.fallbackSize() == 3);
+
+    // The same barcode has the same ID.
+    REQUIRE(codec.encode(StringSpan(string("BC_1234"))) == ids[6]);
+    REQUIRE(codec.fallbackSize() == 3);
+
+    sort(ids.begin(), ids.end());
+    REQUIRE(unique(ids.begin(), ids.end()) == ids.end());
+}
@@ -0,0 +1,32 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/CountMinSketch.h"
+
+TEST_CASE("increment", "[CountMinSketch]")
+{
+    CountMinSketch sketch;
+    REQUIRE(!sketch.enabled());
+    sketch.init(1 << 16, 5);
+    REQUIRE(sketch.enabled());
+
+    REQUIRE(sketch.count(1) == 0);
+    for (unsigned i = 0; i < 5; ++i)
+        REQUIRE(sketch.increment(1) == i);
+
+    // The counters saturate at the limit.
+    REQUIRE(sketch.increment(1) == 5);
+    REQUIRE(sketch.count(1) == 5);
+}
+
+TEST_CASE("never underestimates", "[CountMinSketch]")
+{
+    // A sketch small enough that the keys collide.
+    CountMinSketch sketch;
+    sketch.init(4 * 16, 200);
+    for (uint64_t key = 0; key < 100; ++key)
+        for (uint64_t i = 0; i <= key % 3; ++i)
+            sketch.increment(key);
+    for (uint64_t key = 0; key < 100; ++key)
+        REQUIRE(sketch.count(key) >= key % 3 + 1);
+}
@@ -0,0 +1,76 @@
+#define CATCH_CONFIG_MAIN
+#include "ThirdParty/Catch/catch.hpp"
+
+#include "Common/PoolAllocator.h"
+#include <functional>
+#include <map>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+typedef map<int, int, less<int>, PoolAllocator<pair<const int, int> > > Map;
+
+TEST_CASE("map", "[PoolAllocator]")
+{
+    Map m;
+    for (int i = 0; i < 100000; ++i)
+        m[i] = i;
+    for (int i = 0; i < 100000; i += 2)
+        m.erase(i);
+    REQUIRE(m.size() == 50000);
+
+    // Erased nodes are reused.
+    const int* p = &m.at(1);
+    m.erase(1);
+    m[-1] = -1;
+    REQUIRE(&m.at(-1) == p);
+
+    int sum = 0;
+    for (const auto& x : m)
+        sum += x.second == x.first;
+    REQUIRE(sum == 50000);
+}
+
+TEST_CASE("release", "[PoolAllocator]")
+{
+    typedef unordered_map<int, Map, hash<int>, equal_to<int>,
+        PoolAllocator<pair<const int, Map> > > MapOfMaps;
+    for (int round = 0; round < 2; ++round) {
+        {
+            MapOfMaps m;
+            for (int i = 0; i < 1000; ++i)
+                for (int j = 0; j < 10; ++j)
+                    m[i][j] = i + j;
+            REQUIRE(m.size() == 1000);
+            REQUIRE(m[999][9] == 1008);
+        }
+        PoolArena<>::release();
+    }
+}
+
+TEST_CASE("threads", "[PoolAllocator]")
+{
+    // The nodes freed by another thread are reused.
+    struct Tag { };
+    typedef NodePool<sizeof (int), Tag> Pool;
+    const size_t n = 100000;
+    vector<void*> nodes(n);
+    for (auto& p : nodes)
+        p = Pool::allocate();
+    set<void*> allocated(nodes.begin(), nodes.end());
+    REQUIRE(allocated.size() == n);
+
+    thread t([&nodes]() {
+        for (void* p : nodes)
+            Pool::deallocate(p);
+    });
+    t.join();
+
+    for (size_t i = 0; i < n; ++i)
+        REQUIRE(allocated.count(Pool::allocate()) == 1);
+    PoolArena<Tag>::release();
+}
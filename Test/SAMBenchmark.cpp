@@ -0,0 +1,122 @@
+/**
+ * Measure the per-record cost of extracting the barcode and the
+ * sequence identity of SAM records.
+ * Build with `make SAMBenchmark` and run `./SAMBenchmark [N]`.
+ */
+
+#include "Common/SAM.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/** Generate n SAM records of paired 150 bp reads. */
+static vector<string> generateRecords(size_t n)
+{
+    static const char* cigars[] = {
+        "150M", "5S145M", "70M1I79M", "60M2D90M", "100M50S", "3S40M1D100M7S" };
+    const string seq(150, 'A'), qual(150, 'F');
+    vector<string> lines;
+    lines.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        ostringstream ss;
+        ss << "read" << i / 2 << "\t" << (i % 2 ? 147 : 99)
+            << "\tcontig" << i % 1000 << "\t" << 1 + i % 100000 << "\t60\t"
+            << cigars[i % 6] << "\t=\t" << 301 + i % 100000 << "\t450\t"
+            << seq << "\t" << qual
+            << "\tNM:i:" << i % 4 << "\tMD:Z:150\tAS:i:140\tXS:i:0"
+            << "\tBX:Z:ACGTACGTACGTACGT-1";
+        lines.push_back(ss.str());
+    }
+    return lines;
+}
+
+/** Calculate the sequence identity as ARCS 1.0 did, using a stringstream. */
+static double legacySequenceIdentity(const string& line,
+        const string& cigar, const string& seq)
+{
+    int qalen = 0;
+    stringstream ss;
+    for (auto i = cigar.begin(); i != cigar.end(); ++i) {
+        if (!isdigit(*i)) {
+            if (*i == 'M' || *i == '=' || *i == 'X' || *i == 'I') {
+                ss << "\t";
+                int value = 0;
+                ss >> value;
+                qalen += value;
+                ss.str("");
+            } else {
+                ss.str("");
+            }
+        } else {
+            ss << *i;
+        }
+    }
+
+    int edit_dist = 0;
+    size_t found = line.find("NM:i:");
+    if (found != string::npos)
+        edit_dist = strtol(&line[found + 5], 0, 10);
+
+    return qalen == 0 ? 0 : 100.0 * (qalen - edit_dist) / seq.length();
+}
+
+/** Calculate the sequence identity of a parsed record. */
+static double sequenceIdentity(const SAMRecord& rec)
+{
+    int qalen = rec.alignedQueryLength();
+    return qalen == 0 ? 0
+        : 100.0 * (qalen - rec.editDistance()) / rec.seqLength();
+}
+
+/** Run f on each record and print the time per record. */
+template <typename F>
+static void benchmark(const char* name, const vector<string>& lines, F f)
+{
+    double sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (const auto& line : lines)
+        sum += f(line);
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration<double, nano>(end - start).count();
+    cout << name << '\t' << ns / lines.size() << " ns/record"
+        << "\t(checksum " << sum << ")\n";
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    const vector<string> lines = generateRecords(n);
+
+    benchmark("parse", lines, [](const string& line) {
+        SAMRecord rec;
+        rec.parse(line);
+        return double(rec.tags.size());
+    });
+
+    benchmark("parse+identity+barcode", lines, [](const string& line) {
+        SAMRecord rec;
+        rec.parse(line);
+        return sequenceIdentity(rec) + rec.barcodeTag().size();
+    });
+
+    // The fields are split before timing the legacy identity calculation.
+    vector<string> cigars, seqs;
+    for (const auto& line : lines) {
+        SAMRecord rec;
+        rec.parse(line);
+        cigars.push_back(rec.cigar().str());
+        seqs.push_back(rec.seq().str());
+    }
+    size_t i = 0;
+    benchmark("legacy identity+barcode", lines, [&](const string& line) {
+        double si = legacySequenceIdentity(line, cigars[i], seqs[i]);
+        ++i;
+        return si + parseBXTag(line).size();
+    });
+    return 0;
+}
@@ -13,3 +13,58 @@ TEST_CASE("parseBXTag", "[SAM]")
     REQUIRE(parseBXTag(tags1) == "CGTCAGGTCAGAGGTG-1");
     REQUIRE(parseBXTag(tags2).empty());
 }
+
+TEST_CASE("findSAMTag", "[SAM]")
+{
+    const string tags("QT:Z:AA<FFKKK\tBX:Z:CGTCAGGTCAGAGGTG-1\tNM:i:12");
+
+    REQUIRE(findSAMTag(StringSpan(tags), "BX:Z:") == "CGTCAGGTCAGAGGTG-1");
+    REQUIRE(findSAMTag(StringSpan(tags), "NM:i:") == "12");
+    REQUIRE(findSAMTag(StringSpan(tags), "XT:i:").empty());
+}
+
+TEST_CASE("SAMRecord", "[SAM]")
+{
+    const string line("read1\t99\tcontig1\t1001\t60\t50M1I49M\t=\t1301\t400\t"
+            "ACGT\tFFFF\tNM:i:3\tBX:Z:CGTCAGGTCAGAGGTG-1");
+    SAMRecord rec;
+    REQUIRE(rec.parse(line));
+    REQUIRE(rec.qname() == "read1");
+    REQUIRE(rec.flag() == 99);
+    REQUIRE(rec.rname() == "contig1");
+    REQUIRE(rec.pos() == 1001);
+    REQUIRE(rec.rnext() == "=");
+    REQUIRE(rec.pnext() == 1301);
+    REQUIRE(rec.mapq() == 60);
+    REQUIRE(rec.cigar() == "50M1I49M");
+    REQUIRE(parseInteger(rec.fields[SAMRecord::TLEN]) == 400);
+    REQUIRE(rec.seq() == "ACGT");
+    REQUIRE(rec.tag("NM:i:") == "3");
+    REQUIRE(rec.tag("BX:Z:") == "CGTCAGGTCAGAGGTG-1");
+    REQUIRE(rec.barcodeTag() == "CGTCAGGTCAGAGGTG-1");
+    REQUIRE(rec.editDistance() == 3);
+    REQUIRE(rec.alignedQueryLength() == 100);
+
+    // A record without tags
+    const string untagged("read2\t4\t*\t0\t0\t*\t*\t0\t0\tACGT\tFFFF");
+    REQUIRE(rec.parse(untagged));
+    REQUIRE(rec.rname() == "*");
+    REQUIRE(rec.tags.empty());
+    REQUIRE(rec.barcodeTag().empty());
+    REQUIRE(rec.editDistance() == 0);
+    REQUIRE(rec.alignedQueryLength() == 0);
+
+    // A truncated record
+    const string truncated("read3\t4\t*");
+    REQUIRE(!rec.parse(truncated));
+    REQUIRE(rec.rname() == "*");
+    REQUIRE(rec.seq().empty());
+}
+
+TEST_CASE("cigarAlignedQueryLength", "[SAM]")
+{
+    const string cigar("5S10M2D3I4=1X2N6H");
+    REQUIRE(cigarAlignedQueryLength(cigar.data(), cigar.data() + cigar.size()) == 18);
+    const string empty;
+    REQUIRE(cigarAlignedQueryLength(empty.data(), empty.data()) == 0);
+}
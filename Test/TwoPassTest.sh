@@ -0,0 +1,45 @@
+#!/bin/sh
+# Check that --two-pass with --max-memory links the same contigs as a
+# run without the prefilter.
+set -eu
+
+arcs=${ARCS:-../Arcs/arcs}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# 50 contigs, and 1500 barcodes whose reads link adjacent contigs.
+awk 'BEGIN {
+	n = 50
+	for (i = 0; i < n; ++i)
+		print "@SQ\tSN:c" i "\tLN:10000"
+	seq = sprintf("%100s", ""); gsub(/ /, "A", seq)
+	qual = seq; gsub(/A/, "I", qual)
+	for (b = 0; b < 1500; ++b) {
+		bx = ""
+		for (x = b; length(bx) < 12; x = int(x / 4))
+			bx = substr("ACGT", x % 4 + 1, 1) bx
+		c = b % (n - 1)
+		for (k = 0; k < 4 + b % 5; ++k) {
+			ctg = k % 2 ? c + 1 : c
+			pos = k % 2 ? 100 + 10 * k : 9500 - 10 * k
+			name = "r" b "_" k
+			tags = "NM:i:0\tBX:Z:" bx "-1"
+			print name "\t99\tc" ctg "\t" pos "\t60\t100M\t=\t" pos + 200 "\t300\t" seq "\t" qual "\t" tags
+			print name "\t147\tc" ctg "\t" pos + 200 "\t60\t100M\t=\t" pos "\t-300\t" seq "\t" qual "\t" tags
+		}
+	}
+}' >"$tmp/reads.sam"
+
+$arcs -c 3 -l 0 -m 4-14 -b "$tmp/all" --tsv="$tmp/all.tsv" "$tmp/reads.sam" >/dev/null
+$arcs -c 3 -l 0 -m 4-14 -b "$tmp/two" --tsv="$tmp/two.tsv" \
+	--two-pass --max-memory=4K "$tmp/reads.sam" >/dev/null
+$arcs -c 3 -l 0 -m 4-14 -b "$tmp/four" --tsv="$tmp/four.tsv" \
+	--two-pass --max-memory=4K -t 4 "$tmp/reads.sam" >/dev/null
+
+test "$(wc -l <"$tmp/all.tsv")" -gt 1
+for x in two four; do
+	cut -f1-4,7 "$tmp/all.tsv" >"$tmp/all.links"
+	cut -f1-4,7 "$tmp/$x.tsv" >"$tmp/$x.links"
+	cmp "$tmp/all.links" "$tmp/$x.links"
+	cmp "$tmp/all_original.gv" "$tmp/${x}_original.gv"
+done